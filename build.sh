@@ -2,8 +2,8 @@
 
 # Variables
 CXX="g++"
-CXXFLAGS="-O3 -std=c++17 -Wall -Wextra -ggdb3 -g"
-CXXFLAGS_DEBUG="-O0 -g -std=c++11 -Wall -ggdb3"
+CXXFLAGS="-O3 -std=c++17 -Wall -Wextra -ggdb3 -g -pthread"
+CXXFLAGS_DEBUG="-O0 -g -std=c++11 -Wall -ggdb3 -pthread"
 VALGRIND="valgrind"
 UNIX_BIN_PATH="zbin"
 WINDOWS_BIN_PATH="bin"
@@ -5,7 +5,23 @@
 #define DEBUG_STRESS_GC
 #define DEBUG_LOG_GC
 
-// #define NAN_BOXING
+#define NAN_BOXING
+
+// Scripts and modules are compiled once and cached next to their source
+// as `<file>.zuc`, reused for as long as the source doesn't change.
+#define BYTECODE_CACHE
+
+// Threaded dispatch in run() relies on the GNU "labels as values"
+// extension, other compilers fall back to the switch.
+#if defined(__GNUC__) || defined(__clang__)
+#define COMPUTED_GOTO
+#endif
+
+// Strings are hashed with the SSE4.2 CRC32 instruction on x86-64 CPUs
+// that have it, checked once at startup.
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define HASH_CRC32
+#endif
 
 #define DEBUG_TRACE_EXECUTION
 #define DEBUG_PRINT_CODE
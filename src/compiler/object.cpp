@@ -1,18 +1,29 @@
+#include <cstring>
+#include <vector>
+
 #include "../parser/helper/import.h"
 
+#include "../garbage_collector/gc.h"
 #include "../memory/memory.h"
 #include "../vm/vm.h"
 #include "object.h"
 #include "table.h"
 
+#ifdef HASH_CRC32
+#include <nmmintrin.h>
+#endif
+
 using namespace std;
 
 #define ALLOCATE_OBJ(type, object_type)                                        \
   (type *)allocate_object(sizeof(type), object_type)
 
 struct Obj *allocate_object(size_t size, ObjType type) {
-  struct Obj *object = (struct Obj *)reallocate(NULL, 0, size);
+  struct Obj *object = (struct Obj *)slab_allocate(size);
   object->type = type;
+  object->is_marked = false;
+  object->is_old = false;
+  object->is_remembered = false;
 
   object->next = vm.objects;
   vm.objects = object;
@@ -37,6 +48,7 @@ ObjClass *new_class(ObjString *name) {
   klass->name = name;
   klass->initializer = NIL_VAL;
   init_table(&klass->methods);
+  klass->field_hint = 0;
   return klass;
 }
 
@@ -64,29 +76,117 @@ ObjFunction *new_function() {
 ObjInstance *new_instance(ObjClass *klass) {
   ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
   instance->klass = klass;
-  init_table(&instance->fields);
+  instance->shape = vm.empty_shape;
+  instance->field_capacity = 0;
+  instance->fields = nullptr;
+
+  push(OBJ_VAL(instance));
+  instance_reserve(instance, klass->field_hint);
+  pop();
   return instance;
 }
 
+void instance_reserve(ObjInstance *instance, int count) {
+  if (count <= instance->field_capacity)
+    return;
+
+  int old_capacity = instance->field_capacity;
+  instance->fields =
+      GROW_ARRAY(Value, instance->fields, old_capacity, count);
+  instance->field_capacity = count;
+}
+
+bool instance_get_field(ObjInstance *instance, ObjString *name, Value *value) {
+  int slot = shape_find_slot(instance->shape, name);
+  if (slot < 0)
+    return false;
+
+  *value = instance->fields[slot];
+  return true;
+}
+
+void instance_set_field(ObjInstance *instance, ObjString *name, Value value) {
+  int slot = shape_find_slot(instance->shape, name);
+  if (slot < 0) {
+    push(value);
+    ObjShape *shape = shape_transition(instance->shape, name);
+    slot = shape->field_count - 1;
+    if (slot >= instance->field_capacity)
+      instance_reserve(instance, GROW_CAPACITY(instance->field_capacity));
+    pop();
+
+    instance->shape = shape;
+    write_barrier((Obj *)instance, OBJ_VAL((Obj *)shape));
+    if (instance->klass->field_hint < shape->field_count)
+      instance->klass->field_hint = shape->field_count;
+  }
+
+  instance->fields[slot] = value;
+  write_barrier((Obj *)instance, value);
+}
+
+ObjShape *new_shape() {
+  ObjShape *shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+  shape->field_count = 0;
+  init_table(&shape->slots);
+  init_table(&shape->transitions);
+  return shape;
+}
+
+// Returns the shape reached by adding `name` to `shape`, creating it the
+// first time any instance takes that path.
+ObjShape *shape_transition(ObjShape *shape, ObjString *name) {
+  Value next;
+  if (table_get(&shape->transitions, name, &next))
+    return AS_SHAPE(next);
+
+  ObjShape *child = new_shape();
+  push(OBJ_VAL(child));
+  table_add_all(&shape->slots, &child->slots);
+  table_set(&child->slots, name, NUMBER_VAL(shape->field_count));
+  child->field_count = shape->field_count + 1;
+  table_set(&shape->transitions, name, OBJ_VAL(child));
+  write_barrier((Obj *)shape, OBJ_VAL(name));
+  write_barrier((Obj *)shape, OBJ_VAL(child));
+  pop();
+  return child;
+}
+
+int shape_find_slot(ObjShape *shape, ObjString *name) {
+  Value slot;
+  if (!table_get(&shape->slots, name, &slot))
+    return -1;
+
+  return (int)AS_NUMBER(slot);
+}
+
 ObjNative *new_native(NativeFn function) {
   ObjNative *native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
   native->function = function;
   return native;
 }
 
-ObjString *allocate_string(char *chars, int length, uint32_t hash) {
-  ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+// The characters live in the same block as the header. The result is
+// not interned, fill in `chars` and hand it to intern_string().
+ObjString *new_string(int length) {
+  ObjString *string = (ObjString *)allocate_object(
+      sizeof(ObjString) + length + 1, OBJ_STRING);
   string->length = length;
-  string->chars = chars;
-  string->hash = hash;
+  string->hash = 0;
+  string->interned = false;
+  string->chars[length] = '\0';
+  return string;
+}
 
+static void add_string(ObjString *string) {
+  string->interned = true;
   push(OBJ_VAL(string));
   table_set(&vm.strings, string, NIL_VAL);
   pop();
-  return string;
 }
 
-uint32_t hash_string(const char *key, int length) {
+// FNV-1a, one byte at a time.
+static uint32_t hash_fnv1a(const char *key, int length) {
   uint32_t hash = 2166136261u;
 
   for (int i = 0; i < length; i++) {
@@ -97,59 +197,252 @@ uint32_t hash_string(const char *key, int length) {
   return hash;
 }
 
-ObjString *take_string(char *chars, int length) {
-  uint32_t hash = hash_string(chars, length);
+#ifdef HASH_CRC32
+// CRC32-C over eight bytes per instruction. CRC is linear, so the result
+// is mixed before its low bits pick a table bucket.
+__attribute__((target("sse4.2"))) static uint32_t
+hash_crc32(const char *key, int length) {
+  uint64_t crc = 0xffffffffu ^ (uint32_t)length;
+  int i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t chunk;
+    memcpy(&chunk, key + i, 8);
+    crc = _mm_crc32_u64(crc, chunk);
+  }
 
-  ObjString *existing_string =
-      table_find_string(&vm.strings, chars, length, hash);
-  if (existing_string != nullptr) {
-    FREE_ARRAY(char, chars, length + 1);
-    return existing_string;
+  uint32_t hash = (uint32_t)crc;
+  if (length & 4) {
+    uint32_t chunk;
+    memcpy(&chunk, key + i, 4);
+    hash = _mm_crc32_u32(hash, chunk);
+    i += 4;
   }
+  if (length & 2) {
+    uint16_t chunk;
+    memcpy(&chunk, key + i, 2);
+    hash = _mm_crc32_u16(hash, chunk);
+    i += 2;
+  }
+  if (length & 1)
+    hash = _mm_crc32_u8(hash, (uint8_t)key[i]);
 
-  return allocate_string(chars, length, hash);
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  return hash;
 }
+#endif
 
-ObjString *copy_string(const char *chars, int length) {
-  uint32_t hash = hash_string(chars, length);
+typedef uint32_t (*HashFn)(const char *key, int length);
+
+static HashFn select_hash() {
+#ifdef HASH_CRC32
+  if (__builtin_cpu_supports("sse4.2"))
+    return hash_crc32;
+#endif
+  return hash_fnv1a;
+}
+
+static const HashFn hash_function = select_hash();
+
+uint32_t hash_string(const char *key, int length) {
+  return hash_function(key, length);
+}
 
-  ObjString *existing_string =
-      table_find_string(&vm.strings, chars, length, hash);
+// Returns the interned string equal to `string`, which is `string`
+// itself unless an equal one already existed. Long strings are returned
+// as they are.
+ObjString *intern_string(ObjString *string) {
+  if (string->length >= INTERN_MAX_LENGTH)
+    return string;
+
+  string->hash = hash_string(string->chars, string->length);
+
+  ObjString *existing_string = table_find_string(
+      &vm.strings, string->chars, string->length, string->hash);
   if (existing_string != nullptr)
     return existing_string;
 
-  char *heap_chars = ALLOCATE(char, length + 1);
-  memcpy(heap_chars, chars, length);
-  heap_chars[length] = '\0';
+  add_string(string);
+  return string;
+}
 
-  ObjString *string = allocate_string(heap_chars, length, hash);
+// Names are table keys and compared by address, so they're interned
+// whatever their length.
+ObjString *copy_identifier(const char *chars, int length) {
+  uint32_t hash = hash_string(chars, length);
 
-  // free(heap_chars);
+  ObjString *string = table_find_string(&vm.strings, chars, length, hash);
+  if (string == nullptr) {
+    string = new_string(length);
+    memcpy(string->chars, chars, length);
+    string->hash = hash;
+    add_string(string);
+  }
+  return string;
+}
+
+ObjString *copy_string(const char *chars, int length) {
+  // One character strings are cached so indexing a string doesn't hash
+  // and look up every character it hands out.
+  if (length == 1 && vm.char_strings[(uint8_t)chars[0]] != nullptr)
+    return vm.char_strings[(uint8_t)chars[0]];
+
+  if (length >= INTERN_MAX_LENGTH) {
+    ObjString *string = new_string(length);
+    memcpy(string->chars, chars, length);
+    return string;
+  }
 
+  ObjString *string = copy_identifier(chars, length);
+  if (length == 1)
+    vm.char_strings[(uint8_t)chars[0]] = string;
   return string;
 }
 
+ObjRope *new_rope(Obj *left, Obj *right) {
+  int length = string_length(OBJ_VAL(left)) + string_length(OBJ_VAL(right));
+  ObjRope *rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+  rope->length = length;
+  rope->left = left;
+  rope->right = right;
+  rope->flat = nullptr;
+  return rope;
+}
+
+// Copies the leaves into one string back to front. Ropes built in a loop
+// are deep, so the tree is walked with an explicit stack.
+ObjString *flatten_rope(ObjRope *rope) {
+  if (rope->flat != nullptr)
+    return rope->flat;
+
+  push(OBJ_VAL(rope));
+  ObjString *string = new_string(rope->length);
+  char *end = string->chars + rope->length;
+
+  vector<Obj *> pending;
+  pending.push_back((Obj *)rope);
+  while (!pending.empty()) {
+    Obj *node = pending.back();
+    pending.pop_back();
+
+    ObjString *leaf = (ObjString *)node;
+    if (node->type == OBJ_ROPE) {
+      ObjRope *inner = (ObjRope *)node;
+      if (inner->flat == nullptr) {
+        pending.push_back(inner->left);
+        pending.push_back(inner->right);
+        continue;
+      }
+      leaf = inner->flat;
+    }
+    end -= leaf->length;
+    memcpy(end, leaf->chars, leaf->length);
+  }
+
+  rope->flat = intern_string(string);
+  write_barrier((Obj *)rope, OBJ_VAL(rope->flat));
+  rope->left = nullptr;
+  rope->right = nullptr;
+  pop();
+  return rope->flat;
+}
+
 ObjArray* new_array() {
-  ObjArray* array = ALLOCATE(ObjArray, 1);
+  ObjArray* array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
   array->values = nullptr;
   array->capacity = 0;
   array->count = 0;
+  array->offset = 0;
+  array->numeric = true;
   return array;
 }
 
+// Makes room for at least `capacity` elements. Slots freed at the front
+// are reclaimed first, otherwise the allocation at least doubles.
+void array_reserve(ObjArray *array, int capacity) {
+  if (array->capacity >= capacity)
+    return;
+
+  int total = array->offset + array->capacity;
+  if (array->offset > 0) {
+    Value *base = array->values - array->offset;
+    memmove(base, array->values, array->count * sizeof(Value));
+    array->values = base;
+    array->capacity = total;
+    array->offset = 0;
+    if (total >= capacity)
+      return;
+  }
+
+  int new_capacity = GROW_CAPACITY(total);
+  if (new_capacity < capacity)
+    new_capacity = capacity;
+  array->values = GROW_ARRAY(Value, array->values, total, new_capacity);
+  array->capacity = new_capacity;
+}
+
+// Copies every element of `from` onto the end of `array`.
+void array_append(ObjArray *array, ObjArray *from) {
+  array_reserve(array, array->count + from->count);
+  if (from->count > 0)
+    memcpy(array->values + array->count, from->values,
+           from->count * sizeof(Value));
+  array->count += from->count;
+
+  if (!from->numeric) {
+    array->numeric = false;
+    for (int i = 0; i < from->count; i++)
+      write_barrier((Obj *)array, from->values[i]);
+  }
+}
+
+// Shifts whichever side of `index` is shorter. The front only moves
+// down into slots an earlier removal gave up.
+void array_insert(ObjArray *array, int index, Value value) {
+  if (index < array->count / 2 && array->offset > 0) {
+    array->values--;
+    array->offset--;
+    array->capacity++;
+    memmove(array->values, array->values + 1, index * sizeof(Value));
+  } else {
+    array_reserve(array, array->count + 1);
+    memmove(array->values + index + 1, array->values + index,
+            (array->count - index) * sizeof(Value));
+  }
+
+  array->values[index] = value;
+  array->count++;
+  if (!IS_NUMBER(value))
+    array->numeric = false;
+  write_barrier((Obj *)array, value);
+}
+
+void array_remove(ObjArray *array, int index) {
+  if (index < array->count / 2) {
+    memmove(array->values + 1, array->values, index * sizeof(Value));
+    array->values++;
+    array->offset++;
+    array->capacity--;
+  } else {
+    memmove(array->values + index, array->values + index + 1,
+            (array->count - index - 1) * sizeof(Value));
+  }
+  array->count--;
+}
+
 Value array_read(ObjArray* array, int val) {
   if (val >= array->count) return NIL_VAL;
   return array->values[val];
 }
 
 ObjArray* array_write(ObjArray* array, int val, Value value) {
-  if (array->capacity < val + 1) {
-    int old_capacity = array->capacity;
-    array->capacity = GROW_CAPACITY(old_capacity);
-    array->values = GROW_ARRAY(Value, array->values, old_capacity, array->capacity);
-  }
+  array_reserve(array, val + 1);
   array->values[val] = value;
   array->count = val + 1;
+  if (!IS_NUMBER(value))
+    array->numeric = false;
+  write_barrier((Obj *)array, value);
   return array;
 }
 
@@ -169,8 +462,22 @@ void print_function(ObjFunction *function) {
   cout << "<fn " << function->name->chars << ">";
 }
 
+void print_array(ObjArray *array) {
+  cout << "[";
+  for (int i = 0; i < array->count; i++) {
+    print_value(array->values[i]);
+    if (i != array->count - 1) {
+      cout << ", ";
+    }
+  }
+  cout << "]";
+}
+
 void print_object(Value value) {
   switch (OBJ_TYPE(value)) {
+  case OBJ_ARRAY:
+    print_array(AS_ARRAY(value));
+    break;
   case OBJ_BOUND_METHOD:
     print_function(AS_BOUND_METHOD(value)->method->function);
     break;
@@ -189,6 +496,10 @@ void print_object(Value value) {
   case OBJ_NATIVE:
     cout << "<native fn>";
     break;
+  case OBJ_SHAPE:
+    cout << "shape";
+    break;
+  case OBJ_ROPE:
   case OBJ_STRING:
     for (int i = 0; i < AS_STRING(value)->length; i++) {
       if (AS_STRING(value)->chars[i] == '\\') {
@@ -7,39 +7,52 @@
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
+#define IS_ARRAY(value) is_obj_type(value, OBJ_ARRAY)
 #define IS_BOUND_METHOD(value) is_obj_type(value, OBJ_BOUND_METHOD)
 #define IS_CLASS(value) is_obj_type(value, OBJ_CLASS)
 #define IS_CLOSURE(value) is_obj_type(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value) is_obj_type(value, OBJ_INSTANCE)
 #define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
-#define IS_STRING(value) is_obj_type(value, OBJ_STRING)
+#define IS_ROPE(value) is_obj_type(value, OBJ_ROPE)
+#define IS_SHAPE(value) is_obj_type(value, OBJ_SHAPE)
+#define IS_STRING(value) is_string(value)
 
+#define AS_ARRAY(value) ((ObjArray *)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod *)AS_OBJ(value))
 #define AS_CLASS(value) ((ObjClass *)AS_OBJ(value))
 #define AS_CLOSURE(value) ((ObjClosure *)AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance *)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value))->function)
-#define AS_STRING(value) ((ObjString *)AS_OBJ(value))
-#define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define AS_ROPE(value) ((ObjRope *)AS_OBJ(value))
+#define AS_SHAPE(value) ((ObjShape *)AS_OBJ(value))
+#define AS_STRING(value) as_string(value)
+#define AS_CSTRING(value) (as_string(value)->chars)
 #define AS_MODULE(value) ((ObjModule *)AS_OBJ(value))
 #define AS_TABLE(value) ((Table *)AS_OBJ(value))
 
+#define ARRAY_VAL(object) OBJ_VAL(object)
+
 enum ObjType {
+  OBJ_ARRAY,
   OBJ_BOUND_METHOD,
   OBJ_CLASS,
   OBJ_CLOSURE,
   OBJ_INSTANCE,
   OBJ_FUNCTION,
   OBJ_NATIVE,
+  OBJ_SHAPE,
   OBJ_STRING,
+  OBJ_ROPE,
   OBJ_UPVALUE,
 };
 
 struct Obj {
   ObjType type;
   bool is_marked;
+  bool is_old;        // Survived a collection, lives on vm.old_objects.
+  bool is_remembered; // Old and already in vm.remembered.
   struct Obj *next;
 };
 
@@ -58,11 +71,32 @@ struct ObjNative {
   NativeFn function;
 };
 
+// Strings at least this long skip the intern table, they're rarely
+// compared and hashing them up front is expensive.
+#define INTERN_MAX_LENGTH 256
+
 struct ObjString {
   Obj obj;
   int length;
-  char *chars;
-  uint32_t hash;
+  uint32_t hash; // Only set once the string is interned.
+  bool interned; // Equal interned strings are the same object.
+  char chars[];  // Stored inline after the header, NUL terminated.
+};
+
+// Concatenations shorter than this are copied right away, longer ones
+// become ropes.
+#define ROPE_MIN_LENGTH 128
+
+// Concatenation of two strings whose characters haven't been copied
+// yet. Either side is an ObjString or another ObjRope. The first time
+// the characters are needed the rope is flattened into `flat` and lets
+// go of its children.
+struct ObjRope {
+  Obj obj;
+  int length;
+  Obj *left;
+  Obj *right;
+  ObjString *flat;
 };
 
 struct ObjUpvalue {
@@ -84,6 +118,7 @@ struct ObjClass {
   ObjString *name;
   Value initializer;
   Table methods;
+  int field_hint; // Most fields seen on an instance, used to presize new ones.
 };
 
 struct ObjModule {
@@ -93,10 +128,22 @@ struct ObjModule {
   ObjFunction *function;
 };
 
+// Hidden class shared by every instance that gained the same fields in the
+// same order. `slots` maps a field name to its index in the instance's
+// field array, `transitions` maps the next field name to the child shape.
+struct ObjShape {
+  Obj obj;
+  int field_count;
+  Table slots;
+  Table transitions;
+};
+
 struct ObjInstance {
   Obj obj;
   ObjClass *klass;
-  Table fields;
+  ObjShape *shape;
+  int field_capacity;
+  Value *fields;
 };
 
 struct ObjBoundMethod {
@@ -105,10 +152,20 @@ struct ObjBoundMethod {
   ObjClosure *method;
 };
 
+// `numeric` stays true while every element written so far is a number.
+// With NaN boxing a number Value is its double's bit pattern, so such an
+// array already is a packed double[] and holds no references. The first
+// other value clears it for good.
+//
+// `values` points at the first element. Removing from the front just
+// advances it, `offset` counts the slots given up that way so the
+// allocation starts at values - offset and holds offset + capacity.
 struct ObjArray {
   Obj obj;
   int count;
   int capacity;
+  int offset;
+  bool numeric;
   Value *values;
 };
 
@@ -121,14 +178,30 @@ ObjClosure *new_closure(ObjFunction *function);
 ObjFunction *new_function();
 
 ObjInstance *new_instance(ObjClass *klass);
+bool instance_get_field(ObjInstance *instance, ObjString *name, Value *value);
+void instance_set_field(ObjInstance *instance, ObjString *name, Value value);
+void instance_reserve(ObjInstance *instance, int count);
+
+ObjShape *new_shape();
+ObjShape *shape_transition(ObjShape *shape, ObjString *name);
+int shape_find_slot(ObjShape *shape, ObjString *name);
 
 ObjNative *new_native(NativeFn function);
-ObjString *take_string(char *chars, int length);
+ObjString *new_string(int length);
+ObjString *intern_string(ObjString *string);
 ObjString *copy_string(const char *chars, int length);
+ObjString *copy_identifier(const char *chars, int length);
+
+ObjRope *new_rope(Obj *left, Obj *right);
+ObjString *flatten_rope(ObjRope *rope);
 
 ObjArray* new_array();
 Value array_read(ObjArray* array, int index);
 ObjArray* array_write(ObjArray* array, int val, Value value);
+void array_reserve(ObjArray *array, int capacity);
+void array_append(ObjArray *array, ObjArray *from);
+void array_insert(ObjArray *array, int index, Value value);
+void array_remove(ObjArray *array, int index);
 
 ObjUpvalue *new_upvalue(Value *slot);
 
@@ -137,3 +210,34 @@ void print_object(Value value);
 static inline bool is_obj_type(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
+
+// Ropes are strings as far as the language is concerned, AS_STRING()
+// flattens them on first use.
+static inline bool is_string(Value value) {
+  return IS_OBJ(value) &&
+         (AS_OBJ(value)->type == OBJ_STRING || AS_OBJ(value)->type == OBJ_ROPE);
+}
+
+static inline ObjString *as_string(Value value) {
+  Obj *object = AS_OBJ(value);
+  if (object->type == OBJ_ROPE)
+    return flatten_rope((ObjRope *)object);
+  return (ObjString *)object;
+}
+
+// Interned strings compare by address, long ones by their characters.
+static inline bool strings_equal(ObjString *a, ObjString *b) {
+  if (a == b)
+    return true;
+  if ((a->interned && b->interned) || a->length != b->length)
+    return false;
+  return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+// Length of a string or rope without flattening it.
+static inline int string_length(Value value) {
+  Obj *object = AS_OBJ(value);
+  if (object->type == OBJ_ROPE)
+    return ((ObjRope *)object)->length;
+  return ((ObjString *)object)->length;
+}
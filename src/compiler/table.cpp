@@ -8,6 +8,10 @@
 
 #define TABLE_MAX_LOAD 0.75
 
+// Capacities are always powers of two (see GROW_CAPACITY), so a bucket
+// index is just the low bits of the hash.
+#define TABLE_INDEX(hash, capacity) ((hash) & ((uint32_t)(capacity)-1))
+
 void init_table(Table *table) {
   table->count = 0;
   table->capacity = 0;
@@ -20,7 +24,7 @@ void free_table(Table *table) {
 }
 
 Entry *find_entry(Entry *entries, int capacity, ObjString *key) {
-  uint32_t index = key->hash % (capacity - 1);
+  uint32_t index = TABLE_INDEX(key->hash, capacity);
   Entry *tombstone = nullptr;
 
   for (;;) {
@@ -39,7 +43,7 @@ Entry *find_entry(Entry *entries, int capacity, ObjString *key) {
       // We found the key.
       return entry;
     }
-    index = (index + 1) % (capacity - 1);
+    index = TABLE_INDEX(index + 1, capacity);
   }
 }
 
@@ -132,7 +136,7 @@ ObjString *table_find_string(Table *table, const char *chars, int length,
                              uint32_t hash) {
   if (table->count == 0)
     return NULL;
-  uint32_t index = hash % (table->capacity - 1);
+  uint32_t index = TABLE_INDEX(hash, table->capacity);
 
   for (;;) {
     Entry *entry = &table->entries[index];
@@ -142,14 +146,14 @@ ObjString *table_find_string(Table *table, const char *chars, int length,
       return nullptr;
     }
 
-    if (entry->key != nullptr && entry->key->length == length &&
-        entry->key->hash == hash &&
+    if (entry->key != nullptr && entry->key->hash == hash &&
+        entry->key->length == length &&
         memcmp(entry->key->chars, chars, length) == 0) {
       // We found it.
       return entry->key;
     }
 
-    index = (index + 1) % (table->capacity - 1);
+    index = TABLE_INDEX(index + 1, table->capacity);
   }
 }
 
@@ -9,11 +9,11 @@ using namespace std;
 void print_value(Value value) {
 #ifdef NAN_BOXING
   if (IS_BOOL(value)) {
-    printf(AS_BOOL(value) ? "true" : "false");
+    cout << (AS_BOOL(value) ? "true" : "false");
   } else if (IS_NIL(value)) {
-    printf("nil");
+    cout << "nil";
   } else if (IS_NUMBER(value)) {
-    printf("%g", AS_NUMBER(value));
+    cout << AS_NUMBER(value);
   } else if (IS_OBJ(value)) {
     print_object(value);
   }
@@ -31,25 +31,22 @@ void print_value(Value value) {
   case VAL_OBJ:
     print_object(value);
     break;
-  case VAL_ARRAY:
-    ObjArray *array = AS_ARRAY(value);
-    cout << "[";
-    for (int i = 0; i < array->count; i++) {
-      print_value(array->values[i]);
-      if (i != array->count - 1) {
-        cout << ", ";
-      }
-    }
-    cout << "]";
-    break;
   }
 #endif
 }
 
 bool values_equal(Value a, Value b) {
 #ifdef NAN_BOXING
+  // Compare numbers as doubles so that NaN != NaN, everything else is
+  // equal only when the bits are.
   if (IS_NUMBER(a) && IS_NUMBER(b))
     return AS_NUMBER(a) == AS_NUMBER(b);
+  if (a == b)
+    return true;
+  // Ropes and long strings aren't interned, equal ones can be different
+  // objects.
+  if (IS_STRING(a) && IS_STRING(b))
+    return strings_equal(AS_STRING(a), AS_STRING(b));
   return false;
 #else
   if (a.type != b.type)
@@ -62,6 +59,8 @@ bool values_equal(Value a, Value b) {
   case VAL_NUMBER:
     return AS_NUMBER(a) == AS_NUMBER(b);
   case VAL_OBJ:
+    if (IS_STRING(a) && IS_STRING(b))
+      return strings_equal(AS_STRING(a), AS_STRING(b));
     return AS_OBJ(a) == AS_OBJ(b);
   default:
     return false; // Unreachable.
@@ -6,7 +6,6 @@
 #include "../memory/memory.h"
 
 typedef struct Obj obj;
-typedef struct ObjArray obj_array;
 typedef struct ObjString obj_string;
 
 #ifdef NAN_BOXING
@@ -23,7 +22,7 @@ typedef uint64_t Value;
 #define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
 
-#define IS_BOOL(value) (((value)&FALSE_VAL) == FALSE_VAL)
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
 #define IS_NIL(value) ((value) == NIL_VAL)
 #define IS_NUMBER(value) (((value)&QNAN) != QNAN)
 #define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
@@ -37,27 +36,24 @@ typedef uint64_t Value;
 #define NUMBER_VAL(num) num_to_value(num)
 #define OBJ_VAL(obj) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
-inline Value value_to_num(Value value) {
+inline double value_to_num(Value value) {
   double num;
   memcpy(&num, &value, sizeof(Value));
-  // std::cout << " " << num << std::endl;
   return num;
 }
 
 inline Value num_to_value(double num) {
   Value value;
   memcpy(&value, &num, sizeof(double));
-  // std::cout << " "<< num << std::endl;
   return value;
 }
 #else
 
-enum ValueType { VAL_BOOL, VAL_NIL, VAL_NUMBER, VAL_OBJ, VAL_ARRAY };
+enum ValueType { VAL_BOOL, VAL_NIL, VAL_NUMBER, VAL_OBJ };
 
 struct Value {
   ValueType type;
   union {
-    obj_array *array;
     double number;
     bool boolean;
     Obj *obj;
@@ -68,18 +64,15 @@ struct Value {
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
-#define IS_ARRAY(value)   ((value).type == VAL_ARRAY)
 
 #define AS_BOOL(value)   ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
 #define AS_OBJ(value)    ((value).as.obj)
-#define AS_ARRAY(value)  ((value).as.array)
 
 #define BOOL_VAL(value)   Value{VAL_BOOL, {.boolean = value}}
 #define NIL_VAL           Value{VAL_NIL, {.number = 0}}
 #define NUMBER_VAL(value) Value{VAL_NUMBER, {.number = value}}
 #define OBJ_VAL(object)   Value{VAL_OBJ, {.obj = (Obj *)object}}
-#define ARRAY_VAL(object) Value{VAL_ARRAY, {.obj = (Obj *)object}}
 
 #endif
 
@@ -5,6 +5,7 @@
 #include "../compiler/object.h"
 #include "../compiler/value.h"
 #include "../parser/chunk.h"
+#include "../vm/vm.h"
 #include "debug.h"
 
 using namespace std;
@@ -36,44 +37,111 @@ static int jump_instruction(const char *name, int sign, Chunk *chunk,
   return offset + 3;
 }
 
+// Reads the constant operand after the opcode at `offset`, three bytes
+// for the _LONG instructions, and moves `offset` past it.
+static int read_constant_operand(Chunk *chunk, int *offset) {
+  bool wide = chunk->code[*offset] >= OP_CONSTANT_LONG;
+  (*offset)++;
+  if (!wide)
+    return chunk->code[(*offset)++];
+
+  int constant = (chunk->code[*offset] << 16) |
+                 (chunk->code[*offset + 1] << 8) | chunk->code[*offset + 2];
+  *offset += 3;
+  return constant;
+}
+
 static int constant_instruction(const char *name, Chunk *chunk, int offset) {
-  uint8_t constant = chunk->code[offset + 1];
+  int constant = read_constant_operand(chunk, &offset);
   printf("%-16s %4d - ", name, constant);
   print_value(chunk->constants.values[constant]);
+  return offset;
+}
+
+static int global_instruction(const char *name, Chunk *chunk, int offset) {
+  uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+  slot |= chunk->code[offset + 2];
+  ObjString *global = global_name(slot);
+  printf("%-16s %4d '%s'\n", name, slot,
+         global != nullptr ? global->chars : "?");
+  return offset + 3;
+}
+
+static int cached_instruction(const char *name, Chunk *chunk, int offset) {
+  int constant = read_constant_operand(chunk, &offset);
+  uint16_t cache = (uint16_t)(chunk->code[offset] << 8);
+  cache |= chunk->code[offset + 1];
+  printf("%-16s %4d - ", name, constant);
+  print_value(chunk->constants.values[constant]);
+  printf(" [ic %d]\n", cache);
   return offset + 2;
 }
 
+static int cached_invoke_instruction(const char *name, Chunk *chunk,
+                                     int offset) {
+  int constant = read_constant_operand(chunk, &offset);
+  uint8_t arg_count = chunk->code[offset];
+  uint16_t cache = (uint16_t)(chunk->code[offset + 1] << 8);
+  cache |= chunk->code[offset + 2];
+  printf("%-16s (%d args) %4d - ", name, arg_count, constant);
+  print_value(chunk->constants.values[constant]);
+  printf(" [ic %d]\n", cache);
+  return offset + 3;
+}
+
+static int byte_pair_instruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t first = chunk->code[offset + 1];
+  uint8_t second = chunk->code[offset + 2];
+  printf("%-16s %4d %4d\n", name, first, second);
+  return offset + 3;
+}
+
+static int local_constant_instruction(const char *name, Chunk *chunk,
+                                      int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  printf("%-16s %4d %4d - ", name, slot, constant);
+  print_value(chunk->constants.values[constant]);
+  cout << endl;
+  return offset + 3;
+}
+
 int invoke_instruction(const char *name, Chunk *chunk, int offset) {
-  uint8_t constant = chunk->code[offset + 1];
-  uint8_t arg_count = chunk->code[offset + 2];
+  int constant = read_constant_operand(chunk, &offset);
+  uint8_t arg_count = chunk->code[offset];
   cout << name << "(" << arg_count << " args) " << constant;
   print_value(chunk->constants.values[constant]);
   cout << endl;
-  return offset + 3;
+  return offset + 1;
 }
 
 int disassemble_instruction(Chunk *chunk, int offset) {
   cout << setw(4) << setfill('0') << offset << ' ';
 
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+  int line = get_line(chunk, offset);
+  if (offset > 0 && line == get_line(chunk, offset - 1)) {
     cout << "    | ";
   } else {
-    printf("%4d ", chunk->lines[offset]);
+    printf("%4d ", line);
   }
 
   uint8_t instruction = chunk->code[offset];
   switch (instruction) {
   case OP_CONSTANT:
     return constant_instruction("OP_CONSTANT", chunk, offset);
+  case OP_CONSTANT_LONG:
+    return constant_instruction("OP_CONSTANT_LONG", chunk, offset);
 
   case OP_GET_GLOBAL:
-    return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+    return global_instruction("OP_GET_GLOBAL", chunk, offset);
   case OP_SET_GLOBAL:
-    return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+    return global_instruction("OP_SET_GLOBAL", chunk, offset);
   case OP_DEFINE_GLOBAL:
-    return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+    return global_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+  case OP_GET_STATIC:
+    return global_instruction("OP_GET_STATIC", chunk, offset);
   case OP_DEFINE_STATIC:
-    return constant_instruction("OP_DEFINE_STATIC", chunk, offset);
+    return global_instruction("OP_DEFINE_STATIC", chunk, offset);
 
   case OP_GET_LOCAL:
     return byte_instruction("OP_GET_LOCAL", chunk, offset);
@@ -86,14 +154,22 @@ int disassemble_instruction(Chunk *chunk, int offset) {
     return byte_instruction("OP_SET_UPVALUE", chunk, offset);
 
   case OP_GET_PROPERTY:
-    return constant_instruction("OP_GET_PROPERTY", chunk, offset);
+    return cached_instruction("OP_GET_PROPERTY", chunk, offset);
+  case OP_GET_PROPERTY_LONG:
+    return cached_instruction("OP_GET_PROPERTY_LONG", chunk, offset);
   case OP_SET_PROPERTY:
-    return constant_instruction("OP_SET_PROPERTY", chunk, offset);
+    return cached_instruction("OP_SET_PROPERTY", chunk, offset);
+  case OP_SET_PROPERTY_LONG:
+    return cached_instruction("OP_SET_PROPERTY_LONG", chunk, offset);
 
   case OP_GET_SUPER:
     return constant_instruction("OP_GET_SUPER", chunk, offset);
+  case OP_GET_SUPER_LONG:
+    return constant_instruction("OP_GET_SUPER_LONG", chunk, offset);
   case OP_SUPER_INVOKE:
     return invoke_instruction("OP_SUPER_INVOKE", chunk, offset);
+  case OP_SUPER_INVOKE_LONG:
+    return invoke_instruction("OP_SUPER_INVOKE_LONG", chunk, offset);
 
   case OP_ARRAY:
     return byte_instruction("OP_ARRAY", chunk, offset);
@@ -151,10 +227,12 @@ int disassemble_instruction(Chunk *chunk, int offset) {
   case OP_NEGATE:
     return simple_instruction("OP_NEGATE", offset);
 
-  case OP_CLOSURE: {
-    offset++;
-    uint8_t constant = chunk->code[offset++];
-    printf("%-16s %4d ", "OP_CLOSURE", constant);
+  case OP_CLOSURE:
+  case OP_CLOSURE_LONG: {
+    const char *name =
+        chunk->code[offset] == OP_CLOSURE ? "OP_CLOSURE" : "OP_CLOSURE_LONG";
+    int constant = read_constant_operand(chunk, &offset);
+    printf("%-16s %4d ", name, constant);
     print_value(chunk->constants.values[constant]);
     cout << "\n";
     ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
@@ -175,11 +253,17 @@ int disassemble_instruction(Chunk *chunk, int offset) {
   case OP_CALL:
     return byte_instruction("OP_CALL", chunk, offset);
   case OP_INVOKE:
-    return invoke_instruction("OP_INVOKE", chunk, offset);
+    return cached_invoke_instruction("OP_INVOKE", chunk, offset);
+  case OP_INVOKE_LONG:
+    return cached_invoke_instruction("OP_INVOKE_LONG", chunk, offset);
   case OP_METHOD:
     return constant_instruction("OP_METHOD", chunk, offset);
+  case OP_METHOD_LONG:
+    return constant_instruction("OP_METHOD_LONG", chunk, offset);
   case OP_CLASS:
     return constant_instruction("OP_CLASS", chunk, offset);
+  case OP_CLASS_LONG:
+    return constant_instruction("OP_CLASS_LONG", chunk, offset);
   case OP_IMPORT:
     return simple_instruction("OP_IMPORT", offset);
   case OP_INFO:
@@ -197,6 +281,15 @@ int disassemble_instruction(Chunk *chunk, int offset) {
 
   case OP_RETURN:
     return simple_instruction("OP_RETURN", offset);
+
+  case OP_GET_LOCAL_LOCAL:
+    return byte_pair_instruction("OP_GET_LOCAL_LOCAL", chunk, offset);
+  case OP_ADD_LOCAL_CONSTANT:
+    return local_constant_instruction("OP_ADD_LOCAL_CONSTANT", chunk, offset);
+  case OP_LESS_JUMP_IF_FALSE:
+    return jump_instruction("OP_LESS_JUMP_IF_FALSE", 1, chunk, offset);
+  case OP_GREATER_JUMP_IF_FALSE:
+    return jump_instruction("OP_GREATER_JUMP_IF_FALSE", 1, chunk, offset);
   default:
     cout << "Unknown opcode " << static_cast<int>(instruction) << endl;
     return offset + 1;
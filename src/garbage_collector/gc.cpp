@@ -9,11 +9,24 @@ using namespace std;
     #include "../debug/debug.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+static void gray_object(Obj* object) {
+    if(vm.gray_capacity < vm.gray_count + 1) {
+        vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
+        vm.gray_stack = (Obj**)realloc(vm.gray_stack, sizeof(Obj*) * vm.gray_capacity);
+
+        if(vm.gray_stack == nullptr){
+            ZuraExit(BAD_GRAY_STACK);
+        }
+    }
+    vm.gray_stack[vm.gray_count++] = object;
+}
 
 void mark_object(Obj* object) {
     if(object == nullptr) return;
     if(object->is_marked) return;
+    // A minor collection treats the old generation as live and only
+    // reaches into it through the remembered set.
+    if(vm.gc_minor && object->is_old) return;
 
     #ifndef DEBUG_LOG_GC
         cout<< "\n" << (void*)object << " mark ";
@@ -22,16 +35,7 @@ void mark_object(Obj* object) {
     #endif
 
     object->is_marked = true;
-
-    if(vm.gray_capacity < vm.gray_count + 1) {
-        vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
-        vm.gray_stack = (Obj**)realloc(vm.gray_stack, sizeof(Obj*) + vm.gray_capacity);
-
-        if(vm.gray_stack == nullptr){
-            ZuraExit(BAD_GRAY_STACK);
-        }
-    }
-    vm.gray_stack[vm.gray_count++] = object;
+    gray_object(object);
 }
 
 void mark_value(Value value) {
@@ -44,6 +48,32 @@ void mark_array(ValueArray* array) {
     }
 }
 
+// Called for objects written without a per-field barrier. Besides
+// remembering old objects, an object that was already marked by an
+// incremental collection is grayed again so its new fields get traced.
+void remember_object(Obj* object) {
+    if(vm.gc_marking && object->is_marked) gray_object(object);
+    if(!object->is_old || object->is_remembered) return;
+
+    object->is_remembered = true;
+    if(vm.remembered_capacity < vm.remembered_count + 1) {
+        vm.remembered_capacity = GROW_CAPACITY(vm.remembered_capacity);
+        vm.remembered = (Obj**)realloc(vm.remembered, sizeof(Obj*) * vm.remembered_capacity);
+
+        if(vm.remembered == nullptr){
+            ZuraExit(BAD_GRAY_STACK);
+        }
+    }
+    vm.remembered[vm.remembered_count++] = object;
+}
+
+static void forget_remembered() {
+    for (int i = 0; i < vm.remembered_count; i++) {
+        vm.remembered[i]->is_remembered = false;
+    }
+    vm.remembered_count = 0;
+}
+
 void mark_roots() {
     for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
         mark_value(*slot);
@@ -58,6 +88,16 @@ void mark_roots() {
     }
 
     mark_table(&vm.globals);
+    for (int i = 0; i < vm.global_count; i++) {
+        mark_value(vm.global_slots[i].value);
+    }
+    mark_table(&vm.arrays);
+    mark_array(&vm.array_values);
+    mark_object((Obj*)vm.init_string);
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        mark_object((Obj*)vm.char_strings[i]);
+    }
+    mark_object((Obj*)vm.empty_shape);
     mark_compiler_roots();
 }
 
@@ -69,16 +109,34 @@ void blacken_object(Obj* object) {
     #endif
 
     switch (object->type) {
+      case OBJ_ARRAY: {
+          ObjArray* array = (ObjArray*)object;
+          if (array->numeric) break;
+          for (int i = 0; i < array->count; i++) {
+              mark_value(array->values[i]);
+          }
+          break;
+      }
       case OBJ_CLASS: {
           ObjClass* klass = (ObjClass*)object;
           mark_object((Obj*)klass->name);
+          mark_value(klass->initializer);
           mark_table(&klass->methods);
           break;
       }
       case OBJ_INSTANCE: {
           ObjInstance* instance = (ObjInstance*)object;
           mark_object((Obj*)instance->klass);
-          mark_table(&instance->fields);
+          mark_object((Obj*)instance->shape);
+          for (int i = 0; i < instance->shape->field_count; i++) {
+              mark_value(instance->fields[i]);
+          }
+          break;
+      }
+      case OBJ_SHAPE: {
+          ObjShape* shape = (ObjShape*)object;
+          mark_table(&shape->slots);
+          mark_table(&shape->transitions);
           break;
       }
       case OBJ_BOUND_METHOD: {
@@ -100,6 +158,22 @@ void blacken_object(Obj* object) {
           ObjFunction* function = (ObjFunction*)object;
           mark_object((Obj*)function->name);
           mark_array(&function->chunk.constants);
+          // Inline caches hold strong references so a cached shape or
+          // class can't be freed and have its address reused.
+          for (int i = 0; i < function->chunk.cache_count; i++) {
+              InlineCache* cache = &function->chunk.caches[i];
+              mark_object((Obj*)cache->shape);
+              mark_object((Obj*)cache->transition);
+              mark_object((Obj*)cache->klass);
+              mark_value(cache->method);
+          }
+          break;
+      }
+      case OBJ_ROPE: {
+          ObjRope* rope = (ObjRope*)object;
+          mark_object(rope->left);
+          mark_object(rope->right);
+          mark_object((Obj*)rope->flat);
           break;
       }
       case OBJ_UPVALUE:
@@ -107,8 +181,6 @@ void blacken_object(Obj* object) {
           break;
       case OBJ_NATIVE:
       case OBJ_STRING:
-          ObjString* string = (ObjString*)object;
-          mark_object((Obj*)string->chars);
           break;
     }
 }
@@ -120,18 +192,28 @@ void trace_reference() {
     }
 }
 
+// Runs a major collection to completion. If an incremental one is in
+// progress its marks are kept, the roots are rescanned to catch anything
+// the program moved there since the last step.
 void collect_garbage() {
     #ifndef DEBUG_LOG_GC
         cout << "-- gc begins" << endl;
         size_t before = vm.bytes_allocated;
     #endif
 
+    // Objects left over from the last sweep still carry its marks.
+    if (!vm.gc_marking) sweep_old(0);
+    vm.gc_minor = false;
+    vm.gc_marking = true;
     mark_roots();
     trace_reference();
+    vm.gc_marking = false;
     table_remove_white(&vm.strings);
+    forget_remembered();
     sweep();
 
     vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    vm.nursery_bytes = 0;
 
     #ifndef DEBUG_LOG_GC
         cout << "-- gc end" << endl;
@@ -139,3 +221,68 @@ void collect_garbage() {
              << " to " << vm.bytes_allocated << ") next at " << vm.next_gc << endl;
     #endif
 }
+
+// One bounded slice of a major collection. The first call marks the
+// roots, later ones blacken up to vm.gc_step_budget gray objects, and
+// once the gray stack drains collect_garbage() finishes the cycle. If
+// the heap outgrows marking the cycle is finished right away.
+void collect_incremental() {
+    if (vm.gc_step_budget <= 0) {
+        collect_garbage();
+        return;
+    }
+
+    if (!vm.gc_marking) {
+        #ifndef DEBUG_LOG_GC
+            cout << "-- incremental gc begins" << endl;
+        #endif
+        sweep_old(0);
+        vm.gc_minor = false;
+        vm.gc_marking = true;
+        mark_roots();
+        return;
+    }
+
+    for (int work = 0; work < vm.gc_step_budget && vm.gray_count > 0; work++) {
+        Obj* object = vm.gray_stack[--vm.gray_count];
+        blacken_object(object);
+    }
+
+    if (vm.gray_count == 0 || vm.bytes_allocated > vm.next_gc * GC_HEAP_GROW_FACTOR)
+        collect_garbage();
+}
+
+// Minor collection: only objects allocated since the last collection are
+// traced and swept. Old objects that were written to since then are
+// rescanned through the remembered set. Survivors are promoted.
+void collect_nursery() {
+    #ifndef DEBUG_LOG_GC
+        cout << "-- minor gc begins" << endl;
+        size_t before = vm.bytes_allocated;
+    #endif
+
+    vm.gc_minor = true;
+    mark_roots();
+    for (int i = 0; i < vm.remembered_count; i++) {
+        blacken_object(vm.remembered[i]);
+    }
+    trace_reference();
+    // Only young strings can have died, drop just those from the intern
+    // table instead of scanning all of it.
+    for (Obj* object = vm.objects; object != nullptr; object = object->next) {
+        if (object->type == OBJ_STRING && !object->is_marked &&
+            ((ObjString*)object)->interned)
+            table_delete(&vm.strings, (ObjString*)object);
+    }
+    forget_remembered();
+    sweep_nursery();
+    vm.gc_minor = false;
+
+    vm.nursery_bytes = 0;
+
+    #ifndef DEBUG_LOG_GC
+        cout << "-- minor gc end" << endl;
+        cout << "collected " << before - vm.bytes_allocated << " bytes (from " << before
+             << " to " << vm.bytes_allocated << ")" << endl;
+    #endif
+}
@@ -6,7 +6,36 @@
 #include "../compiler/value.h"
 #include "../vm/vm.h"
 
+// Objects start young and are promoted to the old generation when they
+// survive a collection. A minor collection only traces young objects, so
+// every store that could make an old object point at a young one must go
+// through write_barrier().
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (256 * 1024)
+#endif
+
+// Major collections mark incrementally, blackening at most
+// vm.gc_step_budget objects per allocation while the program keeps
+// running. write_barrier() grays anything stored into an already marked
+// object, and the final pause rescans the roots before sweeping.
+#ifndef GC_STEP_BUDGET
+#define GC_STEP_BUDGET 512
+#endif
+
+#define GC_HEAP_GROW_FACTOR 2
+
 void mark_object(Obj* object);
 void mark_value(Value value);
 void mark_roots();
+void remember_object(Obj* object);
 void collect_garbage();
+void collect_nursery();
+void collect_incremental();
+
+static inline void write_barrier(Obj* object, Value value) {
+    if (!IS_OBJ(value)) return;
+    if (object->is_old && !AS_OBJ(value)->is_old)
+        remember_object(object);
+    if (vm.gc_marking && object->is_marked)
+        mark_object(AS_OBJ(value));
+}
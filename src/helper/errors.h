@@ -42,7 +42,7 @@ inline void error_parser(Token line_no, int pos, const char *msg) {
 inline void runtimeError(const char *format, ...) {
   size_t instruction =
       reinterpret_cast<uint8_t*>(vm.frames->ip) - vm.frames->closure->function->chunk.code - 1;
-  int line = vm.frames->closure->function->chunk.lines[instruction];
+  int line = get_line(&vm.frames->closure->function->chunk, (int)instruction);
   if (vm.frames->closure->function->name != nullptr) {
     cout << "[" << termcolor::yellow << "line" << termcolor::reset << " -> "
          << termcolor::red << line << termcolor::reset << "]["
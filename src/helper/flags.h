@@ -1,17 +1,17 @@
 #include "../vm/vm.h"
 #include "./getCurrentTime.h"
+#include "./mapped_file.h"
 #include "./repl.h"
 #include "./version.h"
 #include "../common.h"
 
 #include <cstring>
-#include <fstream>
 #include <iostream>
 #include <sstream>
 
 using namespace std;
 
-static char *read_file(const char *path) {
+static MappedFile read_file(const char *path) {
 
   if (!path) {
     cout << "+-----------------------------------------+ \n"
@@ -20,27 +20,17 @@ static char *read_file(const char *path) {
     repl(0, NULL);
   }
 
-  ifstream file(path, ios::binary);
-  if (!file) {
+  MappedFile file;
+  if (!open_mapped_file(path, &file)) {
     cerr << "Could not open file \"" << path << "\"." << endl;
     ZuraExit(INVALID_FILE);
   }
-
-  file.seekg(0, ios::end);
-  size_t file_size = file.tellg();
-  file.seekg(0, ios::beg);
-
-  char *buffer = new char[file_size + 1];
-  file.read(buffer, file_size);
-  file.close();
-
-  buffer[file_size] = '\0';
-  return buffer;
+  return file;
 }
 
 inline void run_file(const char *path) {
 
-    const char *source = read_file(path);
+    MappedFile source = read_file(path);
 
     // Check to make sure that we have  a .zu file extension
     if (strcmp(path + strlen(path) - 3, ".zu") != 0) {
@@ -48,7 +38,8 @@ inline void run_file(const char *path) {
         ZuraExit(INVALID_FILE_EXTENSION);
     }
 
-  InterpretResult result = interpret(source);
+  InterpretResult result = interpret_file(path, source.chars);
+  close_mapped_file(&source);
 
   if (result == InterpretResult::INTERPRET_COMPILE_ERROR){
     ZuraExit(COMPILATION_ERROR);
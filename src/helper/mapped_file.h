@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if !_WIN64
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The contents of a file, NUL terminated so the lexer can scan them in
+// place. Regular files are mapped straight from the page cache, anything
+// else (pipes, /dev/stdin, Windows) is read into a buffer.
+struct MappedFile {
+  const char *chars;
+  size_t length;
+
+  void *mapping;       // Base of the mapping, or null when read.
+  size_t mapping_size;
+};
+
+#if !_WIN64
+// Maps `length` bytes of `fd` with a zero page behind them: an anonymous
+// mapping one byte longer is reserved first and the file is mapped over
+// its start, so chars[length] reads as NUL even when the file ends on a
+// page boundary.
+inline bool map_file(int fd, size_t length, MappedFile *file) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (length + 1 + page - 1) / page * page;
+
+  void *base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+  if (base == MAP_FAILED)
+    return false;
+  if (length > 0 && mmap(base, length, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                         fd, 0) == MAP_FAILED) {
+    munmap(base, size);
+    return false;
+  }
+
+  file->chars = (const char *)base;
+  file->length = length;
+  file->mapping = base;
+  file->mapping_size = size;
+  return true;
+}
+#endif
+
+inline bool read_stream(FILE *stream, MappedFile *file) {
+  size_t capacity = 64 * 1024;
+  size_t length = 0;
+  char *buffer = (char *)malloc(capacity);
+  while (buffer != nullptr) {
+    length += fread(buffer + length, 1, capacity - length, stream);
+    if (length < capacity)
+      break;
+    capacity *= 2;
+    char *grown = (char *)realloc(buffer, capacity);
+    if (grown == nullptr)
+      free(buffer);
+    buffer = grown;
+  }
+  if (buffer == nullptr || ferror(stream)) {
+    free(buffer);
+    return false;
+  }
+
+  buffer[length] = '\0';
+  file->chars = buffer;
+  file->length = length;
+  file->mapping = nullptr;
+  file->mapping_size = 0;
+  return true;
+}
+
+// False if the file can't be opened or read.
+inline bool open_mapped_file(const char *path, MappedFile *file) {
+  *file = MappedFile{};
+#if !_WIN64
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  bool mapped = fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+                map_file(fd, (size_t)info.st_size, file);
+  if (mapped) {
+    close(fd);
+    return true;
+  }
+
+  FILE *stream = fdopen(fd, "rb");
+  if (stream == nullptr) {
+    close(fd);
+    return false;
+  }
+#else
+  FILE *stream = fopen(path, "rb");
+  if (stream == nullptr)
+    return false;
+#endif
+
+  bool read = read_stream(stream, file);
+  fclose(stream);
+  return read;
+}
+
+inline void close_mapped_file(MappedFile *file) {
+#if !_WIN64
+  if (file->mapping != nullptr) {
+    munmap(file->mapping, file->mapping_size);
+    file->mapping = nullptr;
+    file->chars = nullptr;
+    return;
+  }
+#endif
+  free((void *)file->chars);
+  file->chars = nullptr;
+}
@@ -25,7 +25,7 @@ typedef struct {
     (x)->patch = ZURA_PATCH_LEVEL;    \
 }
 
-std::string get_Zura_version_string(void) 
+inline std::string get_Zura_version_string(void)
 {
     Zura_version v = {};
     ZURA_VERSION(&v);
@@ -8,16 +8,32 @@
 
 using namespace std;
 
-void *reallocate(void *pointer, size_t old_size, size_t new_size) {
+static void count_allocation(size_t old_size, size_t new_size) {
   vm.bytes_allocated += new_size - old_size;
   if (new_size > old_size) {
+    vm.nursery_bytes += new_size - old_size;
 #ifndef DEBUG_LOG_GC
     cout << "Allocating " << new_size - old_size << " bytes.\n";
+#endif
+#ifndef DEBUG_STRESS_GC
     collect_garbage();
+#else
+    sweep_old(vm.gc_step_budget);
+    // Minor collections wait while a major one is marking, they would
+    // reset the mark bits it relies on.
+    if (vm.gc_marking || vm.bytes_allocated > vm.next_gc)
+      collect_incremental();
+    else if (vm.nursery_bytes > GC_NURSERY_SIZE)
+      collect_nursery();
 #endif
   }
+}
+
+void *reallocate(void *pointer, size_t old_size, size_t new_size) {
+  count_allocation(old_size, new_size);
 
   if (new_size == 0) {
+    free(pointer);
     return nullptr;
   }
 
@@ -29,12 +45,97 @@ void *reallocate(void *pointer, size_t old_size, size_t new_size) {
   return new_pointer;
 }
 
+#define SLAB_PAGE_SIZE (64 * 1024)
+#define SLAB_CLASS_COUNT ((SLAB_MAX_SIZE + 7) / 8)
+#define SLAB_CLASS(size) (((size) + 7) / 8 - 1)
+
+// A freed cell holds the link to the next free cell of its size class.
+struct SlabCell {
+  SlabCell *next;
+};
+
+// Pages start with this header and only ever hold cells of one size.
+struct SlabPage {
+  SlabPage *next;
+};
+
+struct SlabClass {
+  SlabCell *free;
+  char *bump; // Next never used cell in the newest page.
+  char *end;
+};
+
+static SlabClass slab_classes[SLAB_CLASS_COUNT];
+static SlabPage *slab_pages = nullptr;
+
+static void *slab_new_cell(SlabClass *slab, size_t cell_size) {
+  if (slab->bump + cell_size > slab->end) {
+    SlabPage *page = (SlabPage *)malloc(SLAB_PAGE_SIZE);
+    if (page == nullptr) {
+      cerr << "ERROR: Failed to reallocate memory.\n";
+      ZuraExit(MEMORY_FAILURE);
+    }
+    page->next = slab_pages;
+    slab_pages = page;
+    slab->bump = (char *)page + sizeof(SlabPage);
+    slab->end = (char *)page + SLAB_PAGE_SIZE;
+  }
+
+  void *cell = slab->bump;
+  slab->bump += cell_size;
+  return cell;
+}
+
+void *slab_allocate(size_t size) {
+  if (size > SLAB_MAX_SIZE)
+    return reallocate(NULL, 0, size);
+
+  count_allocation(0, size);
+  SlabClass *slab = &slab_classes[SLAB_CLASS(size)];
+  if (slab->free != nullptr) {
+    SlabCell *cell = slab->free;
+    slab->free = cell->next;
+    return cell;
+  }
+  return slab_new_cell(slab, (SLAB_CLASS(size) + 1) * 8);
+}
+
+void slab_free(void *pointer, size_t size) {
+  if (size > SLAB_MAX_SIZE) {
+    reallocate(pointer, size, 0);
+    return;
+  }
+
+  count_allocation(size, 0);
+  SlabClass *slab = &slab_classes[SLAB_CLASS(size)];
+  SlabCell *cell = (SlabCell *)pointer;
+  cell->next = slab->free;
+  slab->free = cell;
+}
+
+static void free_slabs() {
+  while (slab_pages != nullptr) {
+    SlabPage *next = slab_pages->next;
+    free(slab_pages);
+    slab_pages = next;
+  }
+  for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    slab_classes[i] = SlabClass{nullptr, nullptr, nullptr};
+}
+
 static void free_obj(Obj *object) {
 #ifndef DEBUG_LOG_GC
   cout << (void *)object << " free type " << object->type << endl;
 #endif
 
   switch (object->type) {
+    case OBJ_ARRAY: {
+      ObjArray *array = (ObjArray *)object;
+      FREE_ARRAY(Value, array->values - array->offset,
+                 array->offset + array->capacity);
+      FREE(ObjArray, object);
+      break;
+    }
     case OBJ_BOUND_METHOD: {
       FREE(ObjBoundMethod, object);
       break;
@@ -42,6 +143,7 @@ static void free_obj(Obj *object) {
     case OBJ_CLASS: {
       ObjClass *klass = (ObjClass *)object;
       free_table(&klass->methods);
+      FREE(ObjClass, object);
       break;
     }
     case OBJ_CLOSURE: {
@@ -58,7 +160,7 @@ static void free_obj(Obj *object) {
     }
     case OBJ_INSTANCE: {
       ObjInstance *instance = (ObjInstance *)object;
-      free_table(&instance->fields);
+      FREE_ARRAY(Value, instance->fields, instance->field_capacity);
       FREE(ObjInstance, object);
       break;
     }
@@ -66,46 +168,96 @@ static void free_obj(Obj *object) {
       FREE(ObjNative, object);
       break;
     }
+    case OBJ_SHAPE: {
+      ObjShape *shape = (ObjShape *)object;
+      free_table(&shape->slots);
+      free_table(&shape->transitions);
+      FREE(ObjShape, object);
+      break;
+    }
     case OBJ_STRING: {
       ObjString *string = reinterpret_cast<ObjString *>(object);
-      FREE_ARRAY(char, string->chars, string->length + 1);
-      FREE(ObjString, string);
+      slab_free(string, sizeof(ObjString) + string->length + 1);
+      break;
+    }
+    case OBJ_ROPE: {
+      FREE(ObjRope, object);
       break;
     }
     case OBJ_UPVALUE: {
-      ObjClosure *closure = (ObjClosure *)object;
-      FREE_ARRAY(ObjUpvalue *, closure->upvalues, closure->upvalue_count);
       FREE(ObjUpvalue, object);
       break;
     }
   }
 }
 
-void free_objects() {
-  // free memory
-  for(Obj* i = vm.objects; i; i = i->next){
-      free_obj(i);
+static void free_list(Obj *object) {
+  while (object != nullptr) {
+    Obj *next = object->next;
+    free_obj(object);
+    object = next;
   }
 }
 
-void sweep() {
-  Obj *prev = nullptr;
+void free_objects() {
+  free_list(vm.objects);
+  free_list(vm.old_objects);
+  free_list(vm.unswept);
+  vm.objects = nullptr;
+  vm.old_objects = nullptr;
+  vm.unswept = nullptr;
+  free_slabs();
+}
+
+// Frees the unmarked young objects and moves the survivors onto the old
+// list, leaving the nursery empty.
+void sweep_nursery() {
   Obj *obj = vm.objects;
   while (obj != nullptr) {
+    Obj *next = obj->next;
     if (obj->is_marked) {
       obj->is_marked = false;
-      prev = obj;
-      obj = obj->next;
+      obj->is_old = true;
+      obj->next = vm.old_objects;
+      vm.old_objects = obj;
     } else {
-      Obj *unreached = obj;
-      obj = obj->next;
+      free_obj(obj);
+    }
+    obj = next;
+  }
+  vm.objects = nullptr;
+}
 
-      if (prev != nullptr)
-        prev->next = obj;
-      else
-        vm.objects = obj;
+// Sweeps up to `budget` objects of vm.unswept, or all of them when the
+// budget is 0. Survivors go back onto the old list.
+void sweep_old(int budget) {
+  if (vm.unswept == nullptr)
+    return;
 
-      free_obj(unreached);
+  for (int work = 0; vm.unswept != nullptr && (budget <= 0 || work < budget);
+       work++) {
+    Obj *obj = vm.unswept;
+    vm.unswept = obj->next;
+    if (obj->is_marked) {
+      obj->is_marked = false;
+      obj->next = vm.old_objects;
+      vm.old_objects = obj;
+    } else {
+      free_obj(obj);
     }
   }
+
+  // The threshold set by the collection counted the garbage as well.
+  if (vm.unswept == nullptr)
+    vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+}
+
+// The old generation is set aside and swept a slice at a time by later
+// allocations, only the nursery is swept right away.
+void sweep() {
+  vm.unswept = vm.old_objects;
+  vm.old_objects = nullptr;
+  sweep_nursery();
+  if (vm.gc_step_budget <= 0)
+    sweep_old(0);
 }
@@ -7,7 +7,8 @@
 #define ALLOCATE(type, count)                                                  \
   (type *)reallocate(NULL, 0, sizeof(type) * (count))
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+// Objects come from allocate_object(), which takes them from the slab.
+#define FREE(type, pointer) slab_free(pointer, sizeof(type))
 
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity)*2)
 
@@ -15,10 +16,19 @@
   (type *)reallocate(pointer, sizeof(type) * (old_count),                      \
                      sizeof(type) * (new_count))
 
-#define FREE_ARRAY(type, pointer, old_count) delete[] pointer;
+#define FREE_ARRAY(type, pointer, old_count)                                   \
+  reallocate(pointer, sizeof(type) * (old_count), 0)
+
+// Objects up to SLAB_MAX_SIZE bytes are carved out of per-size pages
+// instead of getting a malloc block each, bigger ones fall back to it.
+#ifndef SLAB_MAX_SIZE
+#define SLAB_MAX_SIZE 256
+#endif
 
 void *reallocate(void *pointer, size_t old_size, size_t new_size);
+void *slab_allocate(size_t size);
+void slab_free(void *pointer, size_t size);
 void sweep();
+void sweep_nursery();
+void sweep_old(int budget);
 void free_objects();
-
-//    reallocate(pointer, sizeof(type) * (old_count), 0)
@@ -13,8 +13,8 @@ public:
   static Value define_native(const char *name, NativeFn function) {
     push(OBJ_VAL(copy_string(name, (int)strlen(name))));
     push(OBJ_VAL(new_native(function)));
-    table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
-    Value value = vm.stack[1];
+    define_global(AS_STRING(vm.stack_top[-2]), vm.stack_top[-1]);
+    Value value = vm.stack_top[-1];
     pop();
     pop();
     return value;
@@ -2,12 +2,14 @@
 
 #include <string>
 
+#include "../parser/cache.h"
 #include "std/filesystem.h"
 #include "std/logger.h"
 #include "std/math.h"
 #include "std/std.h"
 
-void define_native(std::string native_name) {
+inline void define_native(std::string native_name) {
+  note_native_include(native_name.c_str());
   if (native_name == "fs") {
     Fs::define_filesystem_natives();
   }
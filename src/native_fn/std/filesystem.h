@@ -28,30 +28,15 @@ private:
     size_t file_size = ftell(file);
     rewind(file);
 
-    char *buffer = (char *)malloc(file_size + 1);
-    if (buffer == NULL) {
-      fclose(file);
-      return NIL_VAL;
-    }
-
-    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
-    if (bytes_read < file_size) {
-      free(buffer);
-      fclose(file);
-      return NIL_VAL;
-    }
-
-    buffer[bytes_read] = '\0';
+    // Read straight into the string, big files are neither copied again
+    // nor hashed.
+    ObjString *content = new_string((int)file_size);
+    size_t bytes_read = fread(content->chars, sizeof(char), file_size, file);
     fclose(file);
+    if (bytes_read < file_size)
+      return NIL_VAL;
 
-    delete file;
-    delete path;
-
-    Value ret = OBJ_VAL(copy_string(buffer, (int)bytes_read));
-    
-    free(buffer);
-
-    return ret;
+    return OBJ_VAL(intern_string(content));
   }
   static Value write_file_native(int arg_count, Value *args) {
     if (arg_count != 2)
@@ -78,10 +63,6 @@ private:
 
     fclose(file);
 
-    delete file;
-    delete path;
-    delete content;
-
     return BOOL_VAL(true);
   }
   static Value generate_file_native(int arg_count, Value *args) {
@@ -98,8 +79,6 @@ private:
 
     fclose(file);
 
-    delete file;
-
     return BOOL_VAL(true);
   }
   static Value delete_file_native(int arg_count, Value *args) {
@@ -113,8 +92,6 @@ private:
       return NIL_VAL;
     }
 
-    delete path;
-
     return BOOL_VAL(true);
   }
 
@@ -1,17 +1,304 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <ctime>
 #include <iostream>
 #include <stdint.h>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "../../compiler/object.h"
+#include "../../vm/thread_pool.h"
 #include "../../vm/vm.h"
 #include "../define_native.h"
 
 class Math {
 private:
+  // Array kernels read the elements straight out of the array as doubles,
+  // so they only take arrays whose elements are all numbers. Big arrays
+  // are split into PARALLEL_GRAIN sized ranges that run on the thread
+  // pool. Reductions combine the ranges in order and keep four partial
+  // results within each, so the result doesn't depend on the number of
+  // threads but rounds differently from adding left to right.
+  static bool is_number_array(Value value) {
+    if (!IS_ARRAY(value))
+      return false;
+    ObjArray *array = AS_ARRAY(value);
+    if (array->numeric)
+      return true;
+    for (int i = 0; i < array->count; i++)
+      if (!IS_NUMBER(array->values[i]))
+        return false;
+    return true;
+  }
+
+  // Allocates the result of an elementwise kernel, with `count` slots for
+  // the caller to fill in.
+  static ObjArray *new_number_array(int count) {
+    ObjArray *array = new_array();
+    push(OBJ_VAL(array));
+    array_reserve(array, count);
+    array->count = count;
+    pop();
+    return array;
+  }
+
+  // Results of `reduce(begin, end)` for each range of a `count` element
+  // array, in order.
+  template <typename Fn>
+  static std::vector<double> reduce_ranges(int count, Fn reduce) {
+    std::vector<double> partial((count + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN);
+    parallel_for(count, PARALLEL_GRAIN, [&](int begin, int end) {
+      partial[begin / PARALLEL_GRAIN] = reduce(begin, end);
+    });
+    return partial;
+  }
+
+  template <typename Fn> static Value map_array(Value value, Fn fn) {
+    ObjArray *from = AS_ARRAY(value);
+    ObjArray *array = new_number_array(from->count);
+    const Value *in = from->values;
+    Value *out = array->values;
+    parallel_for(from->count, PARALLEL_GRAIN, [&](int begin, int end) {
+      for (int i = begin; i < end; i++)
+        out[i] = NUMBER_VAL(fn(AS_NUMBER(in[i])));
+    });
+    return OBJ_VAL(array);
+  }
+
+  static double sum_range(const Value *values, int begin, int end) {
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+      s0 += AS_NUMBER(values[i]);
+      s1 += AS_NUMBER(values[i + 1]);
+      s2 += AS_NUMBER(values[i + 2]);
+      s3 += AS_NUMBER(values[i + 3]);
+    }
+    for (; i < end; i++)
+      s0 += AS_NUMBER(values[i]);
+    return (s0 + s1) + (s2 + s3);
+  }
+
+  static Value sum_native(int arg_count, Value *args) {
+    if (arg_count != 1 || !is_number_array(args[0]))
+      return BOOL_VAL(false);
+
+    ObjArray *array = AS_ARRAY(args[0]);
+    const Value *values = array->values;
+    double total = 0;
+    for (double part : reduce_ranges(array->count, [values](int b, int e) {
+           return sum_range(values, b, e);
+         }))
+      total += part;
+    return NUMBER_VAL(total);
+  }
+
+  static double dot_range(const Value *a, const Value *b, int begin,
+                          int end) {
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+      s0 += AS_NUMBER(a[i]) * AS_NUMBER(b[i]);
+      s1 += AS_NUMBER(a[i + 1]) * AS_NUMBER(b[i + 1]);
+      s2 += AS_NUMBER(a[i + 2]) * AS_NUMBER(b[i + 2]);
+      s3 += AS_NUMBER(a[i + 3]) * AS_NUMBER(b[i + 3]);
+    }
+    for (; i < end; i++)
+      s0 += AS_NUMBER(a[i]) * AS_NUMBER(b[i]);
+    return (s0 + s1) + (s2 + s3);
+  }
+
+  static Value dot_native(int arg_count, Value *args) {
+    if (arg_count != 2 || !is_number_array(args[0]) ||
+        !is_number_array(args[1]))
+      return BOOL_VAL(false);
+
+    ObjArray *a = AS_ARRAY(args[0]);
+    ObjArray *b = AS_ARRAY(args[1]);
+    if (a->count != b->count)
+      return BOOL_VAL(false);
+
+    const Value *x = a->values;
+    const Value *y = b->values;
+    double total = 0;
+    for (double part : reduce_ranges(a->count, [x, y](int begin, int end) {
+           return dot_range(x, y, begin, end);
+         }))
+      total += part;
+    return NUMBER_VAL(total);
+  }
+
+  static inline double pick(double x, double m, bool smallest) {
+    return (smallest ? x < m : x > m) ? x : m;
+  }
+
+  static double extreme_range(const Value *values, int begin, int end,
+                              bool smallest) {
+    double m[4];
+    for (int j = 0; j < 4; j++)
+      m[j] = AS_NUMBER(values[begin]);
+    int i = begin;
+    for (; i + 4 <= end; i += 4)
+      for (int j = 0; j < 4; j++)
+        m[j] = pick(AS_NUMBER(values[i + j]), m[j], smallest);
+    for (; i < end; i++)
+      m[0] = pick(AS_NUMBER(values[i]), m[0], smallest);
+    for (int j = 1; j < 4; j++)
+      m[0] = pick(m[j], m[0], smallest);
+    return m[0];
+  }
+
+  // Smallest element if `smallest`, otherwise the largest. Empty arrays
+  // have neither.
+  static Value extreme(Value value, bool smallest) {
+    ObjArray *array = AS_ARRAY(value);
+    if (array->count == 0)
+      return NIL_VAL;
+
+    const Value *values = array->values;
+    std::vector<double> partial =
+        reduce_ranges(array->count, [=](int begin, int end) {
+          return extreme_range(values, begin, end, smallest);
+        });
+    double m = partial[0];
+    for (double part : partial)
+      m = pick(part, m, smallest);
+    return NUMBER_VAL(m);
+  }
+
+  static Value min_native(int arg_count, Value *args) {
+    if (arg_count != 1 || !is_number_array(args[0]))
+      return BOOL_VAL(false);
+    return extreme(args[0], true);
+  }
+  static Value max_native(int arg_count, Value *args) {
+    if (arg_count != 1 || !is_number_array(args[0]))
+      return BOOL_VAL(false);
+    return extreme(args[0], false);
+  }
+
+  static Value scale_native(int arg_count, Value *args) {
+    if (arg_count != 2 || !is_number_array(args[0]) || !IS_NUMBER(args[1]))
+      return BOOL_VAL(false);
+
+    double factor = AS_NUMBER(args[1]);
+    return map_array(args[0], [factor](double x) { return x * factor; });
+  }
+
+  // Scans every range on its own, then adds the total of the ranges
+  // before it in a second pass.
+  static Value prefix_sum_native(int arg_count, Value *args) {
+    if (arg_count != 1 || !is_number_array(args[0]))
+      return BOOL_VAL(false);
+
+    ObjArray *from = AS_ARRAY(args[0]);
+    ObjArray *array = new_number_array(from->count);
+    const Value *in = from->values;
+    Value *out = array->values;
+    std::vector<double> offsets =
+        reduce_ranges(from->count, [in, out](int begin, int end) {
+          double total = 0;
+          for (int i = begin; i < end; i++) {
+            total += AS_NUMBER(in[i]);
+            out[i] = NUMBER_VAL(total);
+          }
+          return total;
+        });
+
+    double offset = 0;
+    for (double &range_total : offsets) {
+      double total = range_total;
+      range_total = offset;
+      offset += total;
+    }
+
+    parallel_for(from->count, PARALLEL_GRAIN, [&](int begin, int end) {
+      double offset = offsets[begin / PARALLEL_GRAIN];
+      if (offset == 0)
+        return;
+      for (int i = begin; i < end; i++)
+        out[i] = NUMBER_VAL(AS_NUMBER(out[i]) + offset);
+    });
+    return OBJ_VAL(array);
+  }
+
+  // sqrt() can't be vectorized by the compiler since it may set errno,
+  // SSE2 has a packed square root that doesn't.
+  static void sqrt_range(const Value *in, Value *out, int begin, int end) {
+    int i = begin;
+#ifdef __SSE2__
+    for (; i + 2 <= end; i += 2) {
+      __m128i pair = _mm_loadu_si128((const __m128i *)&in[i]);
+      __m128d root = _mm_sqrt_pd(_mm_castsi128_pd(pair));
+      _mm_storeu_si128((__m128i *)&out[i], _mm_castpd_si128(root));
+    }
+#endif
+    for (; i < end; i++)
+      out[i] = NUMBER_VAL(sqrt(AS_NUMBER(in[i])));
+  }
+
+  static Value sqrt_array(Value value) {
+    ObjArray *from = AS_ARRAY(value);
+    ObjArray *array = new_number_array(from->count);
+    const Value *in = from->values;
+    Value *out = array->values;
+    parallel_for(from->count, PARALLEL_GRAIN, [in, out](int begin, int end) {
+      sqrt_range(in, out, begin, end);
+    });
+    return OBJ_VAL(array);
+  }
+
+  // NaNs sort after every number.
+  static bool number_less(Value a, Value b) {
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    return x < y || (y != y && x == x);
+  }
+
+  // Sorts each range in parallel, then merges neighbouring runs pairwise
+  // until one is left.
+  static Value sort_native(int arg_count, Value *args) {
+    if (arg_count != 1 || !is_number_array(args[0]))
+      return BOOL_VAL(false);
+
+    ObjArray *from = AS_ARRAY(args[0]);
+    int count = from->count;
+    ObjArray *array = new_number_array(count);
+    Value *values = array->values;
+    if (count > 0)
+      memcpy(values, from->values, count * sizeof(Value));
+
+    parallel_for(count, PARALLEL_GRAIN, [values](int begin, int end) {
+      std::sort(values + begin, values + end, number_less);
+    });
+
+    std::vector<Value> scratch(count > PARALLEL_GRAIN ? count : 0);
+    Value *src = values;
+    Value *dst = scratch.data();
+    for (int width = PARALLEL_GRAIN; width < count; width *= 2) {
+      int pairs = (count + 2 * width - 1) / (2 * width);
+      parallel_for(pairs, 1, [=](int begin, int end) {
+        for (int pair = begin; pair < end; pair++) {
+          int low = pair * 2 * width;
+          int mid = std::min(low + width, count);
+          int high = std::min(low + 2 * width, count);
+          std::merge(src + low, src + mid, src + mid, src + high, dst + low,
+                     number_less);
+        }
+      });
+      std::swap(src, dst);
+    }
+    if (src != values)
+      memcpy(values, src, count * sizeof(Value));
+    return OBJ_VAL(array);
+  }
+
   static Value random_native(int arg_count, Value *args) {
     (void)args;
     if (arg_count != 0)
@@ -67,6 +354,8 @@ private:
   static Value abs_native(int arg_count, Value *args) {
     if (arg_count != 1)
       return BOOL_VAL(false);
+    if (is_number_array(args[0]))
+      return map_array(args[0], [](double x) { return fabs(x); });
     if (!IS_NUMBER(args[0]))
       return BOOL_VAL(false);
 
@@ -78,6 +367,8 @@ private:
   static Value sqrt_native(int arg_count, Value *args) {
     if (arg_count != 1)
       return BOOL_VAL(false);
+    if (is_number_array(args[0]))
+      return sqrt_array(args[0]);
     if (!IS_NUMBER(args[0]))
       return BOOL_VAL(false);
 
@@ -89,6 +380,11 @@ private:
   static Value log_native(int arg_count, Value *args) {
     if (arg_count != 2)
       return BOOL_VAL(false);
+    if (is_number_array(args[0]) && IS_NUMBER(args[1])) {
+      double log_base = log(AS_NUMBER(args[1]));
+      return map_array(args[0],
+                       [log_base](double x) { return log(x) / log_base; });
+    }
     if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1]))
       return BOOL_VAL(false);
 
@@ -100,6 +396,8 @@ private:
   static Value log10_native(int arg_count, Value *args) {
     if (arg_count != 1)
       return BOOL_VAL(false);
+    if (is_number_array(args[0]))
+      return map_array(args[0], [](double x) { return log10(x); });
     if (!IS_NUMBER(args[0]))
       return BOOL_VAL(false);
 
@@ -111,6 +409,8 @@ private:
   static Value sin_native(int arg_count, Value *args) {
     if (arg_count != 1)
       return BOOL_VAL(false);
+    if (is_number_array(args[0]))
+      return map_array(args[0], [](double x) { return sin(x); });
     if (!IS_NUMBER(args[0]))
       return BOOL_VAL(false);
 
@@ -121,6 +421,8 @@ private:
   static Value cos_native(int arg_count, Value *args) {
     if (arg_count != 1)
       return BOOL_VAL(false);
+    if (is_number_array(args[0]))
+      return map_array(args[0], [](double x) { return cos(x); });
     if (!IS_NUMBER(args[0]))
       return BOOL_VAL(false);
 
@@ -251,5 +553,13 @@ public:
     Natives::define_native("mathAcos", acos_native); // Arch Cosine
     Natives::define_native("mathAtan", atan_native); // Arch Tangent
     Natives::define_native("mathFastFib", fib_native);
+
+    Natives::define_native("mathSum", sum_native);
+    Natives::define_native("mathMin", min_native);
+    Natives::define_native("mathMax", max_native);
+    Natives::define_native("mathDot", dot_native);
+    Natives::define_native("mathScale", scale_native);
+    Natives::define_native("mathPrefixSum", prefix_sum_native);
+    Natives::define_native("mathSort", sort_native);
   }
 };
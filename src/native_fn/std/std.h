@@ -20,13 +20,12 @@ private:
   static Value len_native(int arg_count, Value *args) {
     if (arg_count != 1)
       return BOOL_VAL(false);
+    if (IS_ARRAY(args[0]))
+      return NUMBER_VAL((double)AS_ARRAY(args[0])->count);
     if (!IS_STRING(args[0]))
       return BOOL_VAL(false);
 
-    ObjString *string = AS_STRING(args[0]);
-    double number_length = string->length;
-
-    delete string;
+    double number_length = string_length(args[0]);
 
     return NUMBER_VAL(number_length);
   }
@@ -0,0 +1,664 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../garbage_collector/gc.h"
+#include "../helper/mapped_file.h"
+#include "../helper/version.h"
+#include "../memory/memory.h"
+#include "../native_fn/native.h"
+#include "../vm/vm.h"
+#include "cache.h"
+#include "parser.h"
+
+// A cache file is a fixed header followed by the payload:
+//
+//   "ZUC\0", u32 ZUC_VERSION, u8 major, minor, patch, u8 sizeof(Value)
+//   u64 source hash, u32 source length, u64 payload hash, u32 payload length
+//
+//   i32 count, the natives included at compile time
+//   i32 count, the global names used by the code
+//   the script function
+//
+// Numbers are written in host byte order, a cache is only meant for the
+// machine that wrote it.
+//
+// Global operands are VM slots, which depend on what was defined before
+// the file was compiled. The cache stores them as indexes into its own
+// name table instead and resolves the names again when loading.
+
+enum ConstantTag : uint8_t {
+  CONSTANT_VALUE,    // Anything that isn't an object, stored bit for bit.
+  CONSTANT_STRING,   // u8 interned, then the characters.
+  CONSTANT_FUNCTION, // A nested function, stored like the script.
+};
+
+#define ZUC_HEADER_SIZE 36
+
+static std::vector<std::string> native_includes;
+
+void note_native_include(const char *name) { native_includes.push_back(name); }
+
+static uint64_t hash_bytes(const uint8_t *bytes, size_t length) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+struct Writer {
+  std::string bytes;
+};
+
+template <typename T> static void write_raw(Writer *out, T value) {
+  out->bytes.append((const char *)&value, sizeof(T));
+}
+
+static void write_string(Writer *out, const char *chars, int length) {
+  write_raw<int32_t>(out, length);
+  out->bytes.append(chars, length);
+}
+
+// Reads past the end clear `ok` and return zeroes, so callers can check
+// once after a batch of reads.
+struct Reader {
+  const uint8_t *at;
+  const uint8_t *end;
+  bool ok;
+};
+
+static bool read_bytes(Reader *in, void *to, size_t length) {
+  if (!in->ok || (size_t)(in->end - in->at) < length) {
+    in->ok = false;
+    return false;
+  }
+  memcpy(to, in->at, length);
+  in->at += length;
+  return true;
+}
+
+template <typename T> static T read_raw(Reader *in) {
+  T value{};
+  read_bytes(in, &value, sizeof(T));
+  return value;
+}
+
+// Reads a count of items taking at least `item_size` bytes each, rejecting
+// any that couldn't fit in what's left of the file.
+static int read_count(Reader *in, size_t item_size) {
+  int32_t count = read_raw<int32_t>(in);
+  if (count < 0 || (size_t)count * item_size > (size_t)(in->end - in->at))
+    in->ok = false;
+  return in->ok ? count : 0;
+}
+
+// Points into the file rather than copying, nullptr past the end.
+static const char *read_chars(Reader *in, int *length) {
+  *length = read_count(in, 1);
+  if (!in->ok)
+    return nullptr;
+  const char *chars = (const char *)in->at;
+  in->at += *length;
+  return chars;
+}
+
+// Where an instruction's operands are, offsets are -1 for the ones it
+// doesn't have.
+struct Instruction {
+  int length;   // Bytes taken, 0 if it doesn't decode.
+  int constant; // Constant index, 24-bit when `wide`.
+  bool wide;
+  bool name;    // The constant must be a string.
+  int cache;    // 16-bit inline cache index.
+  int jump;     // 16-bit jump distance, backwards when `backward`.
+  bool backward;
+};
+
+static int read_index(Chunk *chunk, int offset, bool wide) {
+  uint8_t *code = &chunk->code[offset];
+  return wide ? (code[0] << 16) | (code[1] << 8) | code[2] : code[0];
+}
+
+static Instruction decode(Chunk *chunk, int offset) {
+  Instruction instruction = {0, -1, false, false, -1, -1, false};
+  uint8_t op = chunk->code[offset];
+  int length = 0;
+  switch (op) {
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+  case OP_ARRAY:
+  case OP_CALL:
+    length = 2;
+    break;
+  case OP_CONSTANT:
+    length = 2;
+    instruction.constant = offset + 1;
+    break;
+  case OP_GET_SUPER:
+  case OP_METHOD:
+  case OP_CLASS:
+    length = 2;
+    instruction.constant = offset + 1;
+    instruction.name = true;
+    break;
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_GET_STATIC:
+  case OP_DEFINE_STATIC:
+  case OP_GET_LOCAL_LOCAL:
+    length = 3;
+    break;
+  case OP_SUPER_INVOKE:
+    length = 3;
+    instruction.constant = offset + 1;
+    instruction.name = true;
+    break;
+  case OP_ADD_LOCAL_CONSTANT:
+    length = 3;
+    instruction.constant = offset + 2;
+    break;
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP:
+  case OP_BREAK:
+  case OP_LESS_JUMP_IF_FALSE:
+  case OP_GREATER_JUMP_IF_FALSE:
+    length = 3;
+    instruction.jump = offset + 1;
+    break;
+  case OP_LOOP:
+    length = 3;
+    instruction.jump = offset + 1;
+    instruction.backward = true;
+    break;
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+    length = 4;
+    instruction.constant = offset + 1;
+    instruction.name = true;
+    instruction.cache = offset + 2;
+    break;
+  case OP_INVOKE:
+    length = 5;
+    instruction.constant = offset + 1;
+    instruction.name = true;
+    instruction.cache = offset + 3;
+    break;
+  case OP_CONSTANT_LONG:
+    length = 4;
+    instruction.constant = offset + 1;
+    instruction.wide = true;
+    break;
+  case OP_GET_SUPER_LONG:
+  case OP_METHOD_LONG:
+  case OP_CLASS_LONG:
+    length = 4;
+    instruction.constant = offset + 1;
+    instruction.wide = true;
+    instruction.name = true;
+    break;
+  case OP_SUPER_INVOKE_LONG:
+    length = 5;
+    instruction.constant = offset + 1;
+    instruction.wide = true;
+    instruction.name = true;
+    break;
+  case OP_GET_PROPERTY_LONG:
+  case OP_SET_PROPERTY_LONG:
+    length = 6;
+    instruction.constant = offset + 1;
+    instruction.wide = true;
+    instruction.name = true;
+    instruction.cache = offset + 4;
+    break;
+  case OP_INVOKE_LONG:
+    length = 7;
+    instruction.constant = offset + 1;
+    instruction.wide = true;
+    instruction.name = true;
+    instruction.cache = offset + 5;
+    break;
+  case OP_CLOSURE:
+  case OP_CLOSURE_LONG: {
+    // The upvalue operands that follow depend on the function.
+    bool wide = op == OP_CLOSURE_LONG;
+    int width = wide ? 3 : 1;
+    if (offset + width >= chunk->count)
+      return instruction;
+    int constant = read_index(chunk, offset + 1, wide);
+    if (constant >= chunk->constants.count ||
+        !IS_FUNCTION(chunk->constants.values[constant]))
+      return instruction;
+    length = 1 + width +
+             2 * AS_FUNCTION(chunk->constants.values[constant])->upvalue_count;
+    instruction.constant = offset + 1;
+    instruction.wide = wide;
+    break;
+  }
+  default:
+    length = op <= OP_CLASS_LONG ? 1 : 0;
+    break;
+  }
+
+  if (offset + length <= chunk->count)
+    instruction.length = length;
+  return instruction;
+}
+
+static bool is_global_op(uint8_t op) {
+  return op == OP_GET_GLOBAL || op == OP_SET_GLOBAL ||
+         op == OP_DEFINE_GLOBAL || op == OP_GET_STATIC ||
+         op == OP_DEFINE_STATIC;
+}
+
+// Calls `visit(offset)` with the offset of every global operand in the
+// chunk, stopping at the first call that returns false. False if the code
+// doesn't decode or a visit failed.
+template <typename Fn> static bool each_global(Chunk *chunk, Fn visit) {
+  for (int offset = 0; offset < chunk->count;) {
+    int length = decode(chunk, offset).length;
+    if (length == 0)
+      return false;
+    if (is_global_op(chunk->code[offset]) && !visit(offset + 1))
+      return false;
+    offset += length;
+  }
+  return true;
+}
+
+// Checks that the code decodes and that its constant indexes, inline
+// cache indexes and jump targets all stay inside the chunk, jumps landing
+// on an instruction. The payload hash only catches accidents, this keeps
+// a crafted cache from running out of bounds. `cache_count` is set to the
+// number of inline caches the code uses.
+static bool check_code(Chunk *chunk, int *cache_count) {
+  std::vector<bool> starts(chunk->count, false);
+  std::vector<int> targets;
+  *cache_count = 0;
+
+  for (int offset = 0; offset < chunk->count;) {
+    Instruction instruction = decode(chunk, offset);
+    if (instruction.length == 0)
+      return false;
+    starts[offset] = true;
+
+    if (instruction.constant != -1) {
+      int constant = read_index(chunk, instruction.constant, instruction.wide);
+      if (constant >= chunk->constants.count)
+        return false;
+      Value value = chunk->constants.values[constant];
+      if (instruction.name && !is_obj_type(value, OBJ_STRING))
+        return false;
+    }
+    if (instruction.cache != -1) {
+      int cache = (chunk->code[instruction.cache] << 8) |
+                  chunk->code[instruction.cache + 1];
+      if (cache >= *cache_count)
+        *cache_count = cache + 1;
+    }
+    if (instruction.jump != -1) {
+      uint8_t *jump = &chunk->code[instruction.jump];
+      int distance = (jump[0] << 8) | jump[1];
+      int next = offset + instruction.length;
+      targets.push_back(instruction.backward ? next - distance
+                                             : next + distance);
+    }
+    offset += instruction.length;
+  }
+
+  for (int target : targets) {
+    if (target < 0 || target >= chunk->count || !starts[target])
+      return false;
+  }
+  return true;
+}
+
+struct Saver {
+  Writer out;
+  std::vector<ObjString *> slot_names; // Global slot -> name.
+  std::vector<int> slot_index;         // Global slot -> name table index.
+  std::vector<ObjString *> globals;    // The name table.
+};
+
+static bool write_function(Saver *saver, ObjFunction *function) {
+  Writer *out = &saver->out;
+  Chunk *chunk = &function->chunk;
+
+  write_raw<int32_t>(out, function->arity);
+  write_raw<int32_t>(out, function->upvalue_count);
+  write_raw<uint8_t>(out, function->name != nullptr);
+  if (function->name != nullptr)
+    write_string(out, function->name->chars, function->name->length);
+
+  write_raw<int32_t>(out, chunk->constants.count);
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value value = chunk->constants.values[i];
+    if (!IS_OBJ(value)) {
+      write_raw<uint8_t>(out, CONSTANT_VALUE);
+      write_raw<Value>(out, value);
+    } else if (OBJ_TYPE(value) == OBJ_STRING) {
+      ObjString *string = (ObjString *)AS_OBJ(value);
+      write_raw<uint8_t>(out, CONSTANT_STRING);
+      write_raw<uint8_t>(out, string->interned);
+      write_string(out, string->chars, string->length);
+    } else if (OBJ_TYPE(value) == OBJ_FUNCTION) {
+      write_raw<uint8_t>(out, CONSTANT_FUNCTION);
+      if (!write_function(saver, AS_FUNCTION(value)))
+        return false;
+    } else {
+      return false;
+    }
+  }
+
+  // Code thrown away as dead can leave caches nothing refers to.
+  int cache_count;
+  if (!check_code(chunk, &cache_count))
+    return false;
+  write_raw<int32_t>(out, cache_count);
+  write_raw<int32_t>(out, chunk->count);
+  size_t code_start = out->bytes.size();
+  out->bytes.append((const char *)chunk->code, chunk->count);
+  write_raw<int32_t>(out, chunk->line_count);
+  out->bytes.append((const char *)chunk->lines,
+                    sizeof(LineStart) * chunk->line_count);
+
+  return each_global(chunk, [&](int offset) {
+    int slot = (chunk->code[offset] << 8) | chunk->code[offset + 1];
+    if (slot >= (int)saver->slot_names.size() ||
+        saver->slot_names[slot] == nullptr)
+      return false;
+    if (saver->slot_index[slot] == -1) {
+      saver->slot_index[slot] = (int)saver->globals.size();
+      saver->globals.push_back(saver->slot_names[slot]);
+    }
+    int index = saver->slot_index[slot];
+    out->bytes[code_start + offset] = (char)((index >> 8) & 0xff);
+    out->bytes[code_start + offset + 1] = (char)(index & 0xff);
+    return true;
+  });
+}
+
+static void write_header(Writer *out, uint64_t source_hash,
+                         uint32_t source_length, const std::string &payload) {
+  out->bytes.append("ZUC", 4);
+  write_raw<uint32_t>(out, ZUC_VERSION);
+  write_raw<uint8_t>(out, ZURA_MAJOR_VERSION);
+  write_raw<uint8_t>(out, ZURA_MINOR_VERSION);
+  write_raw<uint8_t>(out, ZURA_PATCH_LEVEL);
+  write_raw<uint8_t>(out, sizeof(Value));
+  write_raw<uint64_t>(out, source_hash);
+  write_raw<uint32_t>(out, source_length);
+  write_raw<uint64_t>(out, hash_bytes((const uint8_t *)payload.data(),
+                                      payload.size()));
+  write_raw<uint32_t>(out, (uint32_t)payload.size());
+}
+
+// Creates a temporary file next to `path` that no other process writes
+// to, and stores its name in `temp_path`.
+static FILE *open_temp_file(const char *path, std::string *temp_path) {
+#ifdef _WIN32
+  *temp_path = std::string(path) + "." + std::to_string(_getpid()) + ".tmp";
+  return fopen(temp_path->c_str(), "wb");
+#else
+  *temp_path = std::string(path) + ".XXXXXX";
+  int fd = mkstemp(&(*temp_path)[0]);
+  if (fd < 0)
+    return nullptr;
+  // mkstemp() makes the file private, caches are as readable as sources.
+  fchmod(fd, 0644);
+  FILE *file = fdopen(fd, "wb");
+  if (file == nullptr) {
+    close(fd);
+    remove(temp_path->c_str());
+  }
+  return file;
+#endif
+}
+
+// Writes a temporary file of its own and renames it into place, so
+// readers and concurrent writers only ever see a whole cache.
+static void save_cache(const char *path, ObjFunction *function,
+                       uint64_t source_hash, uint32_t source_length) {
+  Saver saver;
+  saver.slot_names.assign(vm.global_count, nullptr);
+  saver.slot_index.assign(vm.global_count, -1);
+  for (int i = 0; i < vm.globals.capacity; i++) {
+    Entry *entry = &vm.globals.entries[i];
+    if (entry->key != nullptr)
+      saver.slot_names[(int)AS_NUMBER(entry->value)] = entry->key;
+  }
+  if (!write_function(&saver, function))
+    return;
+
+  Writer payload;
+  write_raw<int32_t>(&payload, (int32_t)native_includes.size());
+  for (const std::string &name : native_includes)
+    write_string(&payload, name.data(), (int)name.size());
+  write_raw<int32_t>(&payload, (int32_t)saver.globals.size());
+  for (ObjString *name : saver.globals)
+    write_string(&payload, name->chars, name->length);
+  payload.bytes += saver.out.bytes;
+
+  Writer header;
+  write_header(&header, source_hash, source_length, payload.bytes);
+
+  std::string temp_path;
+  FILE *file = open_temp_file(path, &temp_path);
+  if (file == nullptr)
+    return;
+  bool written =
+      fwrite(header.bytes.data(), 1, header.bytes.size(), file) ==
+          header.bytes.size() &&
+      fwrite(payload.bytes.data(), 1, payload.bytes.size(), file) ==
+          payload.bytes.size();
+  if (fclose(file) != 0 || !written) {
+    remove(temp_path.c_str());
+    return;
+  }
+  if (rename(temp_path.c_str(), path) == 0)
+    return;
+#ifdef _WIN32
+  // Windows won't rename over an existing file.
+  remove(path);
+  if (rename(temp_path.c_str(), path) == 0)
+    return;
+#endif
+  remove(temp_path.c_str());
+}
+
+// Fills in `function`, which the caller keeps reachable. Nested functions
+// are added to its constants before they're read for the same reason.
+static bool read_function(Reader *in, const std::vector<int> &slots,
+                          ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+
+  function->arity = read_raw<int32_t>(in);
+  function->upvalue_count = read_raw<int32_t>(in);
+  bool named = read_raw<uint8_t>(in) != 0;
+  if (!in->ok || function->upvalue_count < 0 ||
+      function->upvalue_count > UINT8_COUNT)
+    return false;
+  if (named) {
+    int length;
+    const char *name = read_chars(in, &length);
+    if (name == nullptr)
+      return false;
+    function->name = copy_identifier(name, length);
+    write_barrier((Obj *)function, OBJ_VAL(function->name));
+  }
+
+  int constant_count = read_count(in, 1);
+  for (int i = 0; i < constant_count && in->ok; i++) {
+    Value value;
+    switch (read_raw<uint8_t>(in)) {
+    case CONSTANT_VALUE:
+      value = read_raw<Value>(in);
+      add_constant(chunk, value);
+      break;
+    case CONSTANT_STRING: {
+      bool interned = read_raw<uint8_t>(in) != 0;
+      int length;
+      const char *chars = read_chars(in, &length);
+      if (chars == nullptr)
+        return false;
+      ObjString *string = interned ? copy_identifier(chars, length)
+                                   : copy_string(chars, length);
+      value = OBJ_VAL(string);
+      add_constant(chunk, value);
+      break;
+    }
+    case CONSTANT_FUNCTION: {
+      ObjFunction *nested = new_function();
+      value = OBJ_VAL(nested);
+      add_constant(chunk, value);
+      write_barrier((Obj *)function, value);
+      if (!read_function(in, slots, nested))
+        return false;
+      continue;
+    }
+    default:
+      return false;
+    }
+    write_barrier((Obj *)function, value);
+  }
+
+  // Cache operands are 16-bit.
+  int cache_count = read_count(in, 0);
+  int count = read_count(in, 1);
+  if (!in->ok || count == 0 || cache_count > UINT16_MAX + 1)
+    return false;
+
+  uint8_t *code = ALLOCATE(uint8_t, count);
+  read_bytes(in, code, count);
+  chunk->code = code;
+  chunk->count = count;
+  chunk->capacity = count;
+
+  int line_count = read_count(in, sizeof(LineStart));
+  if (!in->ok || line_count == 0)
+    return false;
+  LineStart *lines = ALLOCATE(LineStart, line_count);
+  read_bytes(in, lines, sizeof(LineStart) * line_count);
+  chunk->lines = lines;
+  chunk->line_count = line_count;
+  chunk->line_capacity = line_count;
+  if (!in->ok)
+    return false;
+
+  int used_caches;
+  if (!check_code(chunk, &used_caches) || used_caches != cache_count)
+    return false;
+  for (int i = 0; i < cache_count; i++)
+    add_inline_cache(chunk);
+
+  return each_global(chunk, [&](int offset) {
+    int index = (chunk->code[offset] << 8) | chunk->code[offset + 1];
+    if (index >= (int)slots.size())
+      return false;
+    chunk->code[offset] = (uint8_t)((slots[index] >> 8) & 0xff);
+    chunk->code[offset + 1] = (uint8_t)(slots[index] & 0xff);
+    return true;
+  });
+}
+
+static bool read_header(Reader *in, uint64_t source_hash,
+                        uint32_t source_length) {
+  char magic[4] = {};
+  read_bytes(in, magic, sizeof(magic));
+  bool fresh = memcmp(magic, "ZUC", 4) == 0 &&
+               read_raw<uint32_t>(in) == ZUC_VERSION &&
+               read_raw<uint8_t>(in) == ZURA_MAJOR_VERSION &&
+               read_raw<uint8_t>(in) == ZURA_MINOR_VERSION &&
+               read_raw<uint8_t>(in) == ZURA_PATCH_LEVEL &&
+               read_raw<uint8_t>(in) == sizeof(Value) &&
+               read_raw<uint64_t>(in) == source_hash &&
+               read_raw<uint32_t>(in) == source_length;
+  if (!fresh || !in->ok)
+    return false;
+
+  uint64_t payload_hash = read_raw<uint64_t>(in);
+  uint32_t payload_length = read_raw<uint32_t>(in);
+  return in->ok && (size_t)(in->end - in->at) == payload_length &&
+         hash_bytes(in->at, payload_length) == payload_hash;
+}
+
+static ObjFunction *read_payload(Reader *in) {
+  std::vector<std::string> natives;
+  int native_count = read_count(in, sizeof(int32_t));
+  for (int i = 0; i < native_count && in->ok; i++) {
+    int length;
+    const char *name = read_chars(in, &length);
+    if (name != nullptr)
+      natives.push_back(std::string(name, length));
+  }
+
+  std::vector<int> slots;
+  int global_count = read_count(in, sizeof(int32_t));
+  for (int i = 0; i < global_count && in->ok; i++) {
+    int length;
+    const char *name = read_chars(in, &length);
+    if (name == nullptr)
+      break;
+    int slot = global_slot(copy_identifier(name, length));
+    if (slot > UINT16_MAX)
+      return nullptr;
+    slots.push_back(slot);
+  }
+  if (!in->ok)
+    return nullptr;
+
+  ObjFunction *function = new_function();
+  push(OBJ_VAL(function));
+  bool loaded = read_function(in, slots, function) && in->at == in->end;
+  if (loaded) {
+    for (const std::string &name : natives)
+      define_native(name);
+  }
+  pop();
+  return loaded ? function : nullptr;
+}
+
+static ObjFunction *load_cache(const char *path, uint64_t source_hash,
+                               uint32_t source_length) {
+  MappedFile file;
+  if (!open_mapped_file(path, &file))
+    return nullptr;
+
+  const uint8_t *bytes = (const uint8_t *)file.chars;
+  Reader in = {bytes, bytes + file.length, file.length >= ZUC_HEADER_SIZE};
+  ObjFunction *function = nullptr;
+  if (read_header(&in, source_hash, source_length))
+    function = read_payload(&in);
+  close_mapped_file(&file);
+  return function;
+}
+
+ObjFunction *compile_file(const char *path, const char *source) {
+  std::string cache_path = std::string(path) + "c";
+  uint32_t source_length = (uint32_t)strlen(source);
+  uint64_t source_hash = hash_bytes((const uint8_t *)source, source_length);
+
+  ObjFunction *function =
+      load_cache(cache_path.c_str(), source_hash, source_length);
+  if (function != nullptr)
+    return function;
+
+  native_includes.clear();
+  function = compile(source);
+  if (function != nullptr && !compile_reported_errors())
+    save_cache(cache_path.c_str(), function, source_hash, source_length);
+  native_includes.clear();
+  return function;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../compiler/object.h"
+
+// Bump whenever the bytecode or the cache layout changes, older caches
+// are then ignored and rewritten.
+#define ZUC_VERSION 5
+
+// Compiles the script at `path`, or loads it from `<path>c` (foo.zu ->
+// foo.zuc) when that was written for the same source and compiler. A fresh
+// compile is written back there, failures to do so are ignored.
+ObjFunction *compile_file(const char *path, const char *source);
+
+// Called as `include "std/..."` defines natives at compile time, so a
+// cached script can define them again when it's loaded.
+void note_native_include(const char *name);
@@ -6,34 +6,97 @@
 
 void init_chunk(Chunk *chunk) {
 
-  chunk->lines    = nullptr;
   chunk->code     = nullptr;
   chunk->capacity = 0;
   chunk->count    = 0;
 
+  chunk->lines         = nullptr;
+  chunk->line_count    = 0;
+  chunk->line_capacity = 0;
+
+  chunk->caches         = nullptr;
+  chunk->cache_count    = 0;
+  chunk->cache_capacity = 0;
+
   init_value_array(&chunk->constants);
 }
 
 void free_chunk(Chunk *chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
+  FREE_ARRAY(LineStart, chunk->lines, chunk->line_capacity);
   free_value_array(&chunk->constants);
+  FREE_ARRAY(InlineCache, chunk->caches, chunk->cache_capacity);
   init_chunk(chunk);
 }
 
+// Starts a new run unless `line` continues the last one.
+static void add_line(Chunk *chunk, int offset, int line) {
+  // The peephole and constant folding take back bytes, which can leave
+  // the last runs empty.
+  while (chunk->line_count > 0 &&
+         chunk->lines[chunk->line_count - 1].offset >= offset)
+    chunk->line_count--;
+  if (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].line == line)
+    return;
+
+  if (chunk->line_capacity < chunk->line_count + 1) {
+    int old_capacity = chunk->line_capacity;
+    chunk->line_capacity = GROW_CAPACITY(old_capacity);
+    chunk->lines = GROW_ARRAY(LineStart, chunk->lines, old_capacity,
+                              chunk->line_capacity);
+  }
+  chunk->lines[chunk->line_count].offset = offset;
+  chunk->lines[chunk->line_count].line = line;
+  chunk->line_count++;
+}
+
 void write_chunk(Chunk *chunk, uint8_t byte, int line) {
   if (chunk->capacity < chunk->count + 1) {
     int old_capacity = chunk->capacity;
     chunk->capacity = GROW_CAPACITY(old_capacity);
-    chunk->lines = GROW_ARRAY(int, chunk->lines, old_capacity, chunk->capacity);
     chunk->code =
         GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
   }
-  chunk->lines[chunk->count] = line;
   chunk->code[chunk->count] = byte;
+  add_line(chunk, chunk->count, line);
   chunk->count++;
 }
 
+// Line of the byte at `offset`, from the last run starting at or before it.
+int get_line(Chunk *chunk, int offset) {
+  if (chunk->line_count == 0)
+    return 0;
+
+  int low = 0;
+  int high = chunk->line_count - 1;
+  while (low < high) {
+    int mid = low + (high - low + 1) / 2;
+    if (chunk->lines[mid].offset <= offset)
+      low = mid;
+    else
+      high = mid - 1;
+  }
+  return chunk->lines[low].line;
+}
+
+int add_inline_cache(Chunk *chunk) {
+  if (chunk->cache_capacity < chunk->cache_count + 1) {
+    int old_capacity = chunk->cache_capacity;
+    chunk->cache_capacity = GROW_CAPACITY(old_capacity);
+    chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, old_capacity,
+                               chunk->cache_capacity);
+  }
+
+  InlineCache *cache = &chunk->caches[chunk->cache_count];
+  cache->shape = nullptr;
+  cache->transition = nullptr;
+  cache->slot = -1;
+  cache->klass = nullptr;
+  cache->method = NIL_VAL;
+  cache->epoch = 0;
+  return chunk->cache_count++;
+}
+
 int add_constant(Chunk *chunk, Value value) {
   push(value);
   write_value_array(&chunk->constants, value);
@@ -73,18 +73,70 @@ enum OpCode : uint8_t {
   OP_INPUT,
   OP_INFO,
   OP_POP,
+  // Superinstructions, only produced by the compiler's peephole
+  OP_GET_LOCAL_LOCAL,       // OP_GET_LOCAL + OP_GET_LOCAL
+  OP_ADD_LOCAL_CONSTANT,    // OP_GET_LOCAL + OP_CONSTANT + OP_ADD
+  OP_LESS_JUMP_IF_FALSE,    // OP_LESS + OP_JUMP_IF_FALSE + OP_POP
+  OP_GREATER_JUMP_IF_FALSE, // OP_GREATER + OP_JUMP_IF_FALSE + OP_POP
+  // The same instructions with a 24-bit constant index, for constants past
+  // the first 256 in a chunk
+  OP_CONSTANT_LONG,
+  OP_GET_PROPERTY_LONG,
+  OP_SET_PROPERTY_LONG,
+  OP_GET_SUPER_LONG,
+  OP_SUPER_INVOKE_LONG,
+  OP_INVOKE_LONG,
+  OP_CLOSURE_LONG,
+  OP_METHOD_LONG,
+  OP_CLASS_LONG,
+};
+
+// Most constants a chunk can hold, the _LONG instructions address them
+// with three bytes.
+#define CONSTANTS_MAX (1 << 24)
+
+// Per call site cache for OP_GET_PROPERTY, OP_SET_PROPERTY and OP_INVOKE.
+// A field entry is trusted for receivers of `shape` and names their field
+// `slot`; if `transition` is set the store adds that field and moves the
+// receiver to the `transition` shape. A method entry is trusted for
+// receivers of `klass` while the VM's method epoch still equals `epoch`.
+struct InlineCache {
+  struct ObjShape *shape;
+  struct ObjShape *transition;
+  int slot;
+
+  struct ObjClass *klass;
+  Value method;
+  uint32_t epoch;
+};
+
+// Line numbers are run-length encoded. Each entry marks where a run of
+// bytes from the same source line starts, the run ends where the next
+// entry's does.
+struct LineStart {
+  int offset;
+  int line;
 };
 
 struct Chunk {
   uint8_t *code;
   int capacity;
-  int *lines;
   int count;
 
+  LineStart *lines;
+  int line_count;
+  int line_capacity;
+
   ValueArray constants;
+
+  InlineCache *caches;
+  int cache_count;
+  int cache_capacity;
 };
 
 void init_chunk(Chunk *chunk);
 void free_chunk(Chunk *chunk);
 void write_chunk(Chunk *chunk, uint8_t byte, int line);
 int add_constant(Chunk *chunk, Value value);
+int add_inline_cache(Chunk *chunk);
+int get_line(Chunk *chunk, int offset);
@@ -14,7 +14,7 @@ void function(FunctionType type) {
       current->function->arity++;
       if (current->function->arity > 255)
         parser.error_at_current("Can't have more than 255 parameters!");
-      uint8_t constant = parser_variable("Expected paramerter name!");
+      uint16_t constant = parser_variable("Expected paramerter name!");
       define_variable(constant);
     } while (parser.match(COMMA));
   }
@@ -23,12 +23,12 @@ void function(FunctionType type) {
   block();
 
   ObjFunction *function = end_compiler();
-  emit_bytes(OP_CLOSURE, make_constant(OBJ_VAL(function)));
+  emit_constant_op(OP_CLOSURE, make_constant(OBJ_VAL(function)));
 }
 
 void method() {
   parser.consume(IDENTIFIER, "Expected a method name!");
-  uint8_t constant = identifier_constant(&parser.previous);
+  int constant = identifier_constant(&parser.previous);
 
   FunctionType type = TYPE_METHOD;
   if (parser.previous.length == 4 &&
@@ -36,17 +36,17 @@ void method() {
     type = TYPE_INITIALIZER;
   function(type);
 
-  emit_bytes(OP_METHOD, constant);
+  emit_constant_op(OP_METHOD, constant);
 }
 
 void class_declaration() {
   parser.consume(IDENTIFIER, "Expect class name!");
   Token class_name = parser.previous;
-  uint8_t name_constant = identifier_constant(&parser.previous);
+  int name_constant = identifier_constant(&parser.previous);
   declare_variable();
 
-  emit_bytes(OP_CLASS, name_constant);
-  define_variable(name_constant);
+  emit_constant_op(OP_CLASS, name_constant);
+  define_variable(current->scope_depth > 0 ? 0 : global_variable(&class_name));
 
   ClassCompiler class_compiler;
   class_compiler.has_superclass = false;
@@ -84,14 +84,14 @@ void class_declaration() {
 }
 
 void func_declaration() {
-  uint8_t global = parser_variable("Expected a function name!");
+  uint16_t global = parser_variable("Expected a function name!");
   mark_initialized();
   function(TYPE_FUNCTION);
   define_variable(global);
 }
 
 void var_declaration() {
-  uint8_t global = parser_variable("Expect variable name.");
+  uint16_t global = parser_variable("Expect variable name.");
 
   if (parser.match(EQUAL))
     parser.error("You must use a ':=' to declare a variable! While '=' is used "
@@ -110,7 +110,7 @@ void var_declaration() {
 }
 
 void static_var_decleration() {
-  uint8_t global = parser_variable("Expect variable name.");
+  uint16_t global = parser_variable("Expect variable name.");
 
   if (parser.match(EQUAL))
     parser.error("You must use a ':=' to declare a variable! While '=' is used "
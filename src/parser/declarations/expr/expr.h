@@ -11,9 +11,22 @@ void _number(bool can_assign) {
 
 void and_(bool can_assign) {
   (void)can_assign;
-  int end_jump = emit_jump(OP_JUMP_IF_FALSE);
+  Value left;
+  if (trailing_constant(&left)) {
+    if (is_falsey(left)) {
+      // The result is the left operand, the right one never runs.
+      int right = compiling_chunk()->count;
+      parse_precedence(PREC_AND);
+      discard_code(right);
+    } else {
+      drop_constant_ops(1);
+      parse_precedence(PREC_AND);
+    }
+    return;
+  }
+
+  int end_jump = emit_condition_jump();
 
-  emit_byte(OP_POP);
   parse_precedence(PREC_AND);
 
   patch_jump(end_jump);
@@ -21,6 +34,20 @@ void and_(bool can_assign) {
 
 void or_(bool can_assign) {
   (void)can_assign;
+  Value left;
+  if (trailing_constant(&left)) {
+    if (is_falsey(left)) {
+      drop_constant_ops(1);
+      parse_precedence(PREC_OR);
+    } else {
+      // The result is the left operand, the right one never runs.
+      int right = compiling_chunk()->count;
+      parse_precedence(PREC_OR);
+      discard_code(right);
+    }
+    return;
+  }
+
   int else_jump = emit_jump(OP_JUMP_IF_FALSE);
   int end_jump = emit_jump(OP_JUMP);
 
@@ -58,17 +85,17 @@ void super_(bool can_assign) {
 
   parser.consume(DOT, "Expect '.' after 'super'.");
   parser.consume(IDENTIFIER, "Expect superclass method name.");
-  uint8_t name = identifier_constant(&parser.previous);
+  int name = identifier_constant(&parser.previous);
 
   named_variable(synthetic_token("this"), false);
   if (parser.match(LEFT_PAREN)) {
     uint8_t arg_count = argument_list();
     named_variable(synthetic_token("super"), false);
-    emit_bytes(OP_SUPER_INVOKE, name);
+    emit_constant_op(OP_SUPER_INVOKE, name);
     emit_byte(arg_count);
   } else {
     named_variable(synthetic_token("super"), false);
-    emit_bytes(OP_GET_SUPER, name);
+    emit_constant_op(OP_GET_SUPER, name);
   }
 }
 
@@ -88,6 +115,9 @@ void unary(bool can_assign) {
   // Compile the operand
   parse_precedence(PREC_UNARY);
 
+  if (fold_unary(operator_type))
+    return;
+
   // Emit the operator instruction
   switch (operator_type) {
   case BANG:
@@ -109,17 +139,21 @@ void call(bool can_assign) {
 
 void dot(bool can_assign) {
   parser.consume(IDENTIFIER, "Exactly property name after '.'");
-  uint8_t name = identifier_constant(&parser.previous);
+  int name = identifier_constant(&parser.previous);
 
   if (can_assign && parser.match(WALRUS)) {
     expression();
-    emit_bytes(OP_SET_PROPERTY, name);
+    emit_constant_op(OP_SET_PROPERTY, name);
+    emit_inline_cache();
   } else if (parser.match(LEFT_PAREN)) {
     uint8_t arg_count = argument_list();
-    emit_bytes(OP_INVOKE, name);
+    emit_constant_op(OP_INVOKE, name);
     emit_byte(arg_count);
-  } else
-    emit_bytes(OP_GET_PROPERTY, name);
+    emit_inline_cache();
+  } else {
+    emit_constant_op(OP_GET_PROPERTY, name);
+    emit_inline_cache();
+  }
 }
 
 void array_literal(bool can_assign) {
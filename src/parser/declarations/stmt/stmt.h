@@ -38,16 +38,20 @@ void for_statement() {
 
   int surrounding_loop_start = inner_most_loop_start;
   int surrounding_loop_scope = inner_most_loop_scope_depth;
-  inner_most_loop_start = compiling_chunk()->count;
+  inner_most_loop_start = mark_label();
   inner_most_loop_scope_depth = current->scope_depth;
 
   int exit_jump = -1;
   if (!parser.match(SEMICOLON)) {
     expression();
 
-    // Jump out of the loop if the condition is false
-    exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP); // Condition
+    // A condition that's always true is the same as none
+    Value condition;
+    if (trailing_constant(&condition) && !is_falsey(condition))
+      drop_constant_ops(1);
+    else
+      // Jump out of the loop if the condition is false
+      exit_jump = emit_condition_jump();
   }
   parser.consume(RIGHT_PAREN,
                  "Expect ')' after the conditions of the for loop.");
@@ -59,7 +63,7 @@ void for_statement() {
   if (!parser.match(RIGHT_PAREN)) {
     int body_jump = emit_jump(OP_JUMP);
 
-    int increment_start = compiling_chunk()->count;
+    int increment_start = mark_label();
     expression();
     emit_byte(OP_POP);
     parser.consume(RIGHT_PAREN,
@@ -97,7 +101,7 @@ void for_statement() {
 }
 
 void while_statement() {
-  int loop_start = compiling_chunk()->count;
+  int loop_start = mark_label();
   parser.consume(LEFT_PAREN, "Expect '(' after 'while'.");
   if (parser.match(VAR)) {
     for_statement();
@@ -106,6 +110,11 @@ void while_statement() {
   expression();
   parser.consume(RIGHT_PAREN, "Expect ')' after condition.");
 
+  Value condition;
+  bool constant = trailing_constant(&condition);
+  if (constant)
+    drop_constant_ops(1);
+
   if (parser.match(COLON)) {
     parser.consume(LEFT_PAREN, "Expect '(' after ':'.");
     expression();
@@ -113,8 +122,20 @@ void while_statement() {
     emit_byte(OP_POP);
   }
 
-  int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-  emit_byte(OP_POP);
+  // A constant condition either never lets the body run or never ends
+  // the loop, neither needs the test. The increment comes before the test
+  // so it still runs once when the body doesn't.
+  if (constant) {
+    int body = compiling_chunk()->count;
+    statement();
+    if (is_falsey(condition))
+      discard_code(body);
+    else
+      emit_loop(loop_start);
+    return;
+  }
+
+  int exit_jump = emit_condition_jump();
   statement();
   emit_loop(loop_start);
 
@@ -122,13 +143,32 @@ void while_statement() {
   emit_byte(OP_POP);
 }
 
+// Compiles a branch of an if. A branch that can never run is still
+// compiled, so it's checked for errors, but its code is thrown away.
+void branch_statement(bool live) {
+  int start = compiling_chunk()->count;
+  statement();
+  if (!live)
+    discard_code(start);
+}
+
 void if_statement() {
   parser.consume(LEFT_PAREN, "Expect '(' after 'if'.");
   expression();
   parser.consume(RIGHT_PAREN, "Expect ')' after condition.");
 
-  int then_jump = emit_jump(OP_JUMP_IF_FALSE);
-  emit_byte(OP_POP);
+  // With a constant condition only the branch that runs is kept.
+  Value condition;
+  if (trailing_constant(&condition)) {
+    drop_constant_ops(1);
+    bool taken = !is_falsey(condition);
+    branch_statement(taken);
+    if (parser.match(ELSE))
+      branch_statement(!taken);
+    return;
+  }
+
+  int then_jump = emit_condition_jump();
   statement();
 
   int else_jump = emit_jump(OP_JUMP);
@@ -226,10 +266,8 @@ void switch_statement() {
         parser.consume(COLON, "Expect ':' after case value.");
 
         emit_byte(OP_EQUAL);
-        previous_case_skip = emit_jump(OP_JUMP_IF_FALSE);
-
-        // pop the comparison result
-        emit_byte(OP_POP);
+        // pop the comparison result when it matches
+        previous_case_skip = emit_condition_jump();
       } else {
         state = 2;
         parser.consume(COLON, "Expect ':' after default.");
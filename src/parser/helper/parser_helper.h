@@ -1,11 +1,13 @@
 #pragma once
 
+#include <cmath>
 #include <unordered_map>
 
 #include "../../common.h"
 #include "../../compiler/object.h"
 #include "../../helper/errors.h"
 #include "../../lib/colorize.hpp"
+#include "../../vm/vm.h"
 #include "../lexer/tokens.h"
 
 using namespace std;
@@ -16,13 +18,16 @@ public:
   Token previous;
   bool had_error;
   bool panic_mode;
+  int error_count; // Errors reported, they don't stop the compile.
 
-  Parser() : had_error(false), panic_mode(false) {}
+  Parser() : had_error(false), panic_mode(false), error_count(0) {}
 
   void error_at_current(const char *message) {
+    error_count++;
     error_parser(current, current.column, message);
   }
   void error(const char *message) {
+    error_count++;
     error_parser(previous, previous.column, message);
   }
 
@@ -104,6 +109,20 @@ struct Compiler {
   int local_count;
   Upvalue upvalues[UINT8_COUNT];
   int scope_depth;
+
+  // Peephole state: start offsets of the last three instructions the
+  // peephole knows about, oldest first, and the latest jump target in the
+  // chunk. `recent_constants` holds the constant each of those added to
+  // the pool, or -1 when it added none.
+  int recent_ops[3];
+  int recent_constants[3];
+  int last_label;
+
+  // Slots of the numbers and interned strings already in the chunk's
+  // constants, so repeats share one. Numbers are keyed by their bits to
+  // keep 0 and -0 apart.
+  unordered_map<uint64_t, int> number_constants;
+  unordered_map<ObjString *, int> string_constants;
 };
 
 struct ClassCompiler {
@@ -126,13 +145,13 @@ void super_(bool can_assign);
 void begin_scope() { current->scope_depth++; }
 void end_scope();
 
-uint8_t parser_variable(const char *error_msg);
+uint16_t parser_variable(const char *error_msg);
 
 void add_local(Token name);
 void declare_variable();
 void mark_initialized();
-void define_variable(uint8_t global);
-void define_static_variable(uint8_t global);
+void define_variable(uint16_t global);
+void define_static_variable(uint16_t global);
 
 uint8_t argument_list();
 
@@ -143,7 +162,8 @@ void declaration();
 ParseRule *get_rule(TokenKind kind);
 
 void named_variable(Token name, bool can_assign);
-uint8_t identifier_constant(Token *name);
+int identifier_constant(Token *name);
+uint16_t global_variable(Token *name);
 bool identifiers_equal(Token *a, Token *b);
 
 void grouping(bool can_assign);
@@ -177,6 +197,11 @@ void emit_bytes(uint8_t byte1, uint8_t byte2) {
   emit_byte(byte2);
 }
 
+void emit_short(uint16_t value) {
+  emit_byte((value >> 8) & 0xff);
+  emit_byte(value & 0xff);
+}
+
 void emit_loop(int loop_start) {
   emit_byte(OP_LOOP);
 
@@ -195,14 +220,85 @@ int emit_jump(uint8_t instruction) {
   return compiling_chunk()->count - 2;
 }
 
-uint8_t make_constant(Value value) {
+// Adds `value` to the chunk's constants, reusing the slot of an equal
+// number or interned string that's already there.
+int make_constant(Value value) {
+  uint64_t bits = 0;
+  ObjString *string = nullptr;
+  if (IS_NUMBER(value)) {
+    double number = AS_NUMBER(value);
+    memcpy(&bits, &number, sizeof(bits));
+    auto found = current->number_constants.find(bits);
+    if (found != current->number_constants.end())
+      return found->second;
+  } else if (is_obj_type(value, OBJ_STRING) &&
+             ((ObjString *)AS_OBJ(value))->interned) {
+    string = (ObjString *)AS_OBJ(value);
+    auto found = current->string_constants.find(string);
+    if (found != current->string_constants.end())
+      return found->second;
+  }
+
   int constant = add_constant(compiling_chunk(), value);
-  if (constant > UINT8_MAX) {
+  if (constant >= CONSTANTS_MAX) {
     parser.error("Too many constants in one chunk.");
     return 0;
   }
 
-  return static_cast<uint8_t>(constant);
+  if (IS_NUMBER(value))
+    current->number_constants[bits] = constant;
+  else if (string != nullptr)
+    current->string_constants[string] = constant;
+  return constant;
+}
+
+static uint8_t long_op(uint8_t op) {
+  switch (op) {
+  case OP_CONSTANT:
+    return OP_CONSTANT_LONG;
+  case OP_GET_PROPERTY:
+    return OP_GET_PROPERTY_LONG;
+  case OP_SET_PROPERTY:
+    return OP_SET_PROPERTY_LONG;
+  case OP_GET_SUPER:
+    return OP_GET_SUPER_LONG;
+  case OP_SUPER_INVOKE:
+    return OP_SUPER_INVOKE_LONG;
+  case OP_INVOKE:
+    return OP_INVOKE_LONG;
+  case OP_CLOSURE:
+    return OP_CLOSURE_LONG;
+  case OP_METHOD:
+    return OP_METHOD_LONG;
+  case OP_CLASS:
+    return OP_CLASS_LONG;
+  default:
+    return op; // Unreachable
+  }
+}
+
+// Emits `op` and its constant operand, switching to the _LONG form of the
+// instruction once the index doesn't fit in a byte.
+void emit_constant_op(uint8_t op, int constant) {
+  if (constant <= UINT8_MAX) {
+    emit_bytes(op, (uint8_t)constant);
+    return;
+  }
+
+  emit_byte(long_op(op));
+  emit_byte((constant >> 16) & 0xff);
+  emit_byte((constant >> 8) & 0xff);
+  emit_byte(constant & 0xff);
+}
+
+// Gives the instruction just emitted its own inline cache, as a 16-bit
+// index into the chunk's cache table.
+void emit_inline_cache() {
+  int cache = add_inline_cache(compiling_chunk());
+  if (cache > UINT16_MAX)
+    parser.error("Too many property accesses in one chunk.");
+
+  emit_short((uint16_t)cache);
 }
 
 void emit_return() {
@@ -213,7 +309,317 @@ void emit_return() {
   emit_byte(OP_RETURN);
 }
 
-void emit_constant(Value v) { emit_bytes(OP_CONSTANT, make_constant(v)); }
+// Peephole
+//
+// A few short sequences are fused into superinstructions as they are
+// emitted. The compiler notes where the instructions it may fuse start;
+// a sequence is only rewritten when those instructions are still the
+// last bytes in the chunk and no jump lands inside it.
+
+// Records the current offset as a jump target (e.g. a loop start) and
+// returns it.
+int mark_label() {
+  current->last_label = compiling_chunk()->count;
+  return current->last_label;
+}
+
+// `constant` is the pool slot the instruction added, if any.
+void note_op(int offset, int constant = -1) {
+  for (int i = 0; i < 2; i++) {
+    current->recent_ops[i] = current->recent_ops[i + 1];
+    current->recent_constants[i] = current->recent_constants[i + 1];
+  }
+  current->recent_ops[2] = offset;
+  current->recent_constants[2] = constant;
+}
+
+// Drops the newest `count` noted instructions after they were taken back.
+void forget_ops(int count) {
+  for (int i = 2; i >= 0; i--) {
+    current->recent_ops[i] = i >= count ? current->recent_ops[i - count] : -1;
+    current->recent_constants[i] =
+        i >= count ? current->recent_constants[i - count] : -1;
+  }
+}
+
+bool can_fuse(int start, int length) {
+  return start >= 0 && start + length == compiling_chunk()->count &&
+         current->last_label <= start;
+}
+
+void emit_get_local(uint8_t slot) {
+  Chunk *chunk = compiling_chunk();
+  int last = current->recent_ops[2];
+
+  if (can_fuse(last, 2) && chunk->code[last] == OP_GET_LOCAL) {
+    chunk->code[last] = OP_GET_LOCAL_LOCAL;
+    emit_byte(slot);
+    return;
+  }
+
+  note_op(chunk->count);
+  emit_bytes(OP_GET_LOCAL, slot);
+}
+
+void emit_add() {
+  Chunk *chunk = compiling_chunk();
+  int local = current->recent_ops[1];
+  int constant = current->recent_ops[2];
+
+  if (constant == local + 2 && can_fuse(local, 4) &&
+      chunk->code[local] == OP_GET_LOCAL &&
+      chunk->code[constant] == OP_CONSTANT) {
+    // [GET_LOCAL slot][CONSTANT index] -> [ADD_LOCAL_CONSTANT slot index]
+    chunk->code[local] = OP_ADD_LOCAL_CONSTANT;
+    chunk->code[local + 2] = chunk->code[local + 3];
+    chunk->count--;
+    forget_ops(2);
+    note_op(local);
+    return;
+  }
+
+  emit_byte(OP_ADD);
+}
+
+void emit_compare(uint8_t op) {
+  note_op(compiling_chunk()->count);
+  emit_byte(op);
+}
+
+// Emits the OP_JUMP_IF_FALSE + OP_POP that guards a condition. The jump
+// still leaves the condition on the stack for the code it lands on.
+int emit_condition_jump() {
+  Chunk *chunk = compiling_chunk();
+  int last = current->recent_ops[2];
+
+  if (can_fuse(last, 1) &&
+      (chunk->code[last] == OP_LESS || chunk->code[last] == OP_GREATER)) {
+    chunk->code[last] = chunk->code[last] == OP_LESS
+                            ? OP_LESS_JUMP_IF_FALSE
+                            : OP_GREATER_JUMP_IF_FALSE;
+    emit_byte(0xff);
+    emit_byte(0xff);
+    return chunk->count - 2;
+  }
+
+  int jump = emit_jump(OP_JUMP_IF_FALSE);
+  emit_byte(OP_POP);
+  return jump;
+}
+
+void emit_constant(Value v) {
+  int pooled = compiling_chunk()->constants.count;
+  int constant = make_constant(v);
+  note_op(compiling_chunk()->count, constant >= pooled ? constant : -1);
+  emit_constant_op(OP_CONSTANT, constant);
+}
+
+// Emits OP_TRUE, OP_FALSE or OP_NIL.
+void emit_literal(uint8_t op) {
+  note_op(compiling_chunk()->count);
+  emit_byte(op);
+}
+
+// Constant folding
+//
+// Operators whose operands are all constants are evaluated as they are
+// compiled: the operands' instructions are taken back off the end of the
+// chunk, the same way the peephole fuses them, and the result is pushed
+// as a constant instead. Anything the VM would reject at runtime (e.g.
+// `1 - "a"`) is left for the VM to report.
+
+// Length of the instruction at `offset` if it only pushes a constant,
+// with the value in `value`, 0 otherwise.
+int constant_op_at(int offset, Value *value) {
+  Chunk *chunk = compiling_chunk();
+  if (offset < 0 || offset >= chunk->count)
+    return 0;
+
+  uint8_t *code = &chunk->code[offset];
+  int room = chunk->count - offset;
+  switch (code[0]) {
+  case OP_CONSTANT:
+    if (room < 2)
+      return 0;
+    *value = chunk->constants.values[code[1]];
+    return 2;
+  case OP_CONSTANT_LONG:
+    if (room < 4)
+      return 0;
+    *value =
+        chunk->constants.values[(code[1] << 16) | (code[2] << 8) | code[3]];
+    return 4;
+  case OP_TRUE:
+    *value = BOOL_VAL(true);
+    return 1;
+  case OP_FALSE:
+    *value = BOOL_VAL(false);
+    return 1;
+  case OP_NIL:
+    *value = NIL_VAL;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// The value the chunk's last instruction pushes, if it's a constant that
+// can still be taken back.
+bool trailing_constant(Value *value) {
+  int last = current->recent_ops[2];
+  int length = constant_op_at(last, value);
+  return length > 0 && can_fuse(last, length);
+}
+
+// Takes back the newest `count` noted instructions, which end the chunk,
+// along with any constants they were the first to add.
+void drop_constant_ops(int count) {
+  Chunk *chunk = compiling_chunk();
+  chunk->count = current->recent_ops[3 - count];
+
+  for (int i = 2; i >= 3 - count; i--) {
+    int constant = current->recent_constants[i];
+    if (constant < 0 || constant != chunk->constants.count - 1)
+      continue;
+
+    Value value = chunk->constants.values[constant];
+    if (IS_NUMBER(value)) {
+      double number = AS_NUMBER(value);
+      uint64_t bits;
+      memcpy(&bits, &number, sizeof(bits));
+      current->number_constants.erase(bits);
+    } else if (is_obj_type(value, OBJ_STRING)) {
+      current->string_constants.erase((ObjString *)AS_OBJ(value));
+    }
+    chunk->constants.count--;
+  }
+  forget_ops(count);
+}
+
+void emit_folded(Value value) {
+  if (IS_BOOL(value))
+    emit_literal(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  else if (IS_NIL(value))
+    emit_literal(OP_NIL);
+  else
+    emit_constant(value);
+}
+
+// Folds the unary `operator_type` (! or -) over a constant operand.
+bool fold_unary(TokenKind operator_type) {
+  Value operand;
+  if (!trailing_constant(&operand))
+    return false;
+
+  Value result;
+  if (operator_type == BANG)
+    result = BOOL_VAL(is_falsey(operand));
+  else if (operator_type == MINUS && IS_NUMBER(operand))
+    result = NUMBER_VAL(-AS_NUMBER(operand));
+  else
+    return false;
+
+  drop_constant_ops(1);
+  emit_folded(result);
+  return true;
+}
+
+// Result of the binary `operator_type` on two constants, matching what
+// the VM computes. False if the VM would raise an error instead.
+bool fold_values(TokenKind operator_type, Value a, Value b, Value *result) {
+  switch (operator_type) {
+  case EQUAL:
+    *result = BOOL_VAL(values_equal(a, b));
+    return true;
+  case BANG_EQUAL:
+    *result = BOOL_VAL(!values_equal(a, b));
+    return true;
+  default:
+    break;
+  }
+
+  if (operator_type == PLUS && is_obj_type(a, OBJ_STRING) &&
+      is_obj_type(b, OBJ_STRING)) {
+    ObjString *left = (ObjString *)AS_OBJ(a);
+    ObjString *right = (ObjString *)AS_OBJ(b);
+    ObjString *string = new_string(left->length + right->length);
+    memcpy(string->chars, left->chars, left->length);
+    memcpy(string->chars + left->length, right->chars, right->length);
+    *result = OBJ_VAL(intern_string(string));
+    return true;
+  }
+
+  if (!IS_NUMBER(a) || !IS_NUMBER(b))
+    return false;
+
+  double x = AS_NUMBER(a);
+  double y = AS_NUMBER(b);
+  switch (operator_type) {
+  case PLUS:
+    *result = NUMBER_VAL(x + y);
+    return true;
+  case MINUS:
+    *result = NUMBER_VAL(x - y);
+    return true;
+  case STAR:
+    *result = NUMBER_VAL(x * y);
+    return true;
+  case SLASH:
+    *result = NUMBER_VAL(x / y);
+    return true;
+  case MODULO:
+    *result = NUMBER_VAL(fmod(x, y));
+    return true;
+  case POWER:
+    *result = NUMBER_VAL(pow(x, y));
+    return true;
+  // >= and <= compile to the negated opposite comparison, fold them the
+  // same way so NaN compares alike.
+  case GREATER:
+    *result = BOOL_VAL(x > y);
+    return true;
+  case GREATER_EQUAL:
+    *result = BOOL_VAL(!(x < y));
+    return true;
+  case LESS:
+    *result = BOOL_VAL(x < y);
+    return true;
+  case LESS_EQUAL:
+    *result = BOOL_VAL(!(x > y));
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Folds the binary `operator_type` when both operands are constants.
+bool fold_binary(TokenKind operator_type) {
+  int left = current->recent_ops[1];
+  int right = current->recent_ops[2];
+  Value a = NIL_VAL, b = NIL_VAL;
+  int left_length = constant_op_at(left, &a);
+  int right_length = constant_op_at(right, &b);
+  if (left_length == 0 || right_length == 0 || left + left_length != right ||
+      !can_fuse(left, left_length + right_length))
+    return false;
+
+  Value result;
+  if (!fold_values(operator_type, a, b, &result))
+    return false;
+
+  drop_constant_ops(2);
+  emit_folded(result);
+  return true;
+}
+
+// Throws away the code emitted since `offset`, for statements compiled
+// only to be checked because a constant condition means they never run.
+// The constants, names and inline caches they made are left in place.
+void discard_code(int offset) {
+  compiling_chunk()->count = offset;
+  forget_ops(3);
+  current->last_label = offset;
+}
 
 void patch_jump(int offset) {
   // -2 to adjust for the bytecode for the jump offset itself.
@@ -225,6 +631,7 @@ void patch_jump(int offset) {
 
   compiling_chunk()->code[offset] = (jump >> 8) & 0xff;
   compiling_chunk()->code[offset + 1] = jump & 0xff;
+  current->last_label = compiling_chunk()->count;
 }
 
 void var_declaration();
@@ -15,12 +15,17 @@ void init_compiler(Compiler *compiler, FunctionType type) {
   compiler->type = type;
   compiler->local_count = 0;
   compiler->scope_depth = 0;
+  for (int i = 0; i < 3; i++) {
+    compiler->recent_ops[i] = -1;
+    compiler->recent_constants[i] = -1;
+  }
+  compiler->last_label = 0;
   compiler->function = new_function();
   current = compiler;
 
   if (type != TYPE_SCRIPT)
     current->function->name =
-        copy_string(parser.previous.start, parser.previous.length);
+        copy_identifier(parser.previous.start, parser.previous.length);
 
   Local *local = &current->locals[current->local_count++];
   local->depth = 0;
@@ -45,6 +50,9 @@ ObjFunction *end_compiler() {
                                              : "<script>");
 #endif
 
+  // Constants were added without a barrier, keep the function scanned
+  // until the next collection in case it was promoted mid-compile.
+  remember_object((Obj *)function);
   current = current->enclosing;
   return function;
 }
@@ -64,8 +72,19 @@ void end_scope() {
   }
 }
 
-uint8_t identifier_constant(Token *name) {
-  return make_constant(OBJ_VAL(copy_string(name->start, name->length)));
+int identifier_constant(Token *name) {
+  return make_constant(OBJ_VAL(copy_identifier(name->start, name->length)));
+}
+
+// Globals are addressed by their slot in the VM, resolved here once.
+uint16_t global_variable(Token *name) {
+  int slot = global_slot(copy_identifier(name->start, name->length));
+  if (slot > UINT16_MAX) {
+    parser.error("Too many global variables.");
+    return 0;
+  }
+
+  return static_cast<uint16_t>(slot);
 }
 
 bool identifiers_equal(Token *a, Token *b) {
@@ -151,14 +170,14 @@ void declare_variable() {
   add_local(*name);
 }
 
-uint8_t parser_variable(const char *error_msg) {
+uint16_t parser_variable(const char *error_msg) {
   parser.consume(IDENTIFIER, error_msg);
 
   declare_variable();
   if (current->scope_depth > 0)
     return 0;
 
-  return identifier_constant(&parser.previous);
+  return global_variable(&parser.previous);
 }
 
 void mark_initialized() {
@@ -167,20 +186,22 @@ void mark_initialized() {
   current->locals[current->local_count - 1].depth = current->scope_depth;
 }
 
-void define_variable(uint8_t global) {
+void define_variable(uint16_t global) {
   if (current->scope_depth > 0) {
     mark_initialized();
     return;
   }
-  emit_bytes(OP_DEFINE_GLOBAL, global);
+  emit_byte(OP_DEFINE_GLOBAL);
+  emit_short(global);
 }
 
-void define_static_variable(uint8_t global) {
+void define_static_variable(uint16_t global) {
   if (current->scope_depth > 0) {
     mark_initialized();
     return;
   }
-  emit_bytes(OP_DEFINE_STATIC, global);
+  emit_byte(OP_DEFINE_STATIC);
+  emit_short(global);
 }
 
 uint8_t argument_list() {
@@ -206,10 +227,13 @@ void binary(bool can_assign) {
   ParseRule *rule = get_rule(operator_type);
   parse_precedence(static_cast<Precedence>(rule->precedence + 1));
 
+  if (fold_binary(operator_type))
+    return;
+
   // Emit the operator instruction
   switch (operator_type) {
   case PLUS:
-    emit_byte(OP_ADD);
+    emit_add();
     break;
   case MINUS:
     emit_byte(OP_SUBTRACT);
@@ -235,13 +259,13 @@ void binary(bool can_assign) {
     emit_byte(OP_EQUAL);
     break; // ==
   case GREATER:
-    emit_byte(OP_GREATER);
+    emit_compare(OP_GREATER);
     break; // >
   case GREATER_EQUAL:
     emit_bytes(OP_LESS, OP_NOT);
     break; // >=
   case LESS:
-    emit_byte(OP_LESS);
+    emit_compare(OP_LESS);
     break; // <
   case LESS_EQUAL:
     emit_bytes(OP_GREATER, OP_NOT);
@@ -256,13 +280,13 @@ void literal(bool can_assign) {
   (void)can_assign;
   switch (parser.previous.kind) {
   case TK_FALSE:
-    emit_byte(OP_FALSE);
+    emit_literal(OP_FALSE);
     break;
   case TK_TRUE:
-    emit_byte(OP_TRUE);
+    emit_literal(OP_TRUE);
     break;
   case NIL:
-    emit_byte(OP_NIL);
+    emit_literal(OP_NIL);
     break;
   default:
     return; // Unreachable
@@ -329,6 +353,15 @@ void grouping(bool can_assign) {
   parser.consume(RIGHT_PAREN, "Expect ')' after expression.");
 }
 
+// Locals and upvalues take a byte operand, globals a 16-bit slot.
+static void emit_variable(uint8_t op, int arg) {
+  emit_byte(op);
+  if (op == OP_GET_GLOBAL || op == OP_SET_GLOBAL)
+    emit_short((uint16_t)arg);
+  else
+    emit_byte((uint8_t)arg);
+}
+
 void named_variable(Token name, bool can_assign) {
   uint8_t get_op, set_op;
   int arg = resolve_local(current, &name);
@@ -338,27 +371,24 @@ void named_variable(Token name, bool can_assign) {
   } else if ((arg = resolve_upvalue(current, &name)) != -1) {
     get_op = OP_GET_UPVALUE;
     set_op = OP_SET_UPVALUE;
-  } else if ((arg = identifier_constant(&name)) != -1) {
+  } else {
+    arg = global_variable(&name);
     get_op = OP_GET_GLOBAL;
     set_op = OP_SET_GLOBAL;
-  } else {
-    string message = "Undefined variable name '";
-    message += name.start;
-    message += "'.";
-    parser.error(message.c_str());
-    return;
   }
 
   if (parser.match(WALRUS) && can_assign) {
     expression();
-    emit_bytes(set_op, (uint8_t)arg);
+    emit_variable(set_op, arg);
   } else if (can_assign && (parser.match(INCREMENT) || parser.match(DECREMENT))) {
     TokenKind op = parser.previous.kind;
-    emit_bytes(get_op, (uint8_t)arg);
+    emit_variable(get_op, arg);
     emit_byte(op == INCREMENT ? OP_INCREMENT : OP_DECREMENT);
-    emit_bytes(set_op, (uint8_t)arg);
+    emit_variable(set_op, arg);
+  } else if (get_op == OP_GET_LOCAL) {
+    emit_get_local((uint8_t)arg);
   } else {
-    emit_bytes(get_op, (uint8_t)arg);
+    emit_variable(get_op, arg);
   }
 }
 
@@ -371,6 +401,7 @@ ObjFunction *compile(const char *source) {
 
   parser.had_error = false;
   parser.panic_mode = false;
+  parser.error_count = 0;
 
   parser.advance();
 
@@ -382,10 +413,14 @@ ObjFunction *compile(const char *source) {
   return parser.had_error ? nullptr : function;
 }
 
+bool compile_reported_errors() { return parser.error_count > 0; }
+
 void mark_compiler_roots() {
   Compiler *compiler = current;
   while (compiler != nullptr) {
     mark_object((Obj *)compiler->function);
+    // Functions under construction are written without a barrier.
+    remember_object((Obj *)compiler->function);
     compiler = compiler->enclosing;
   }
 }
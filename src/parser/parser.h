@@ -4,4 +4,7 @@
 #include "../vm/vm.h"
 
 ObjFunction *compile(const char *source);
+// Whether the last compile() printed any errors. The script still runs,
+// but it shouldn't be cached since a cached copy would skip the errors.
+bool compile_reported_errors();
 void mark_compiler_roots();
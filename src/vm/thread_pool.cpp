@@ -0,0 +1,137 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+
+// One range of a parallel_run().
+struct Task {
+  RangeFn body;
+  void *context;
+  int begin;
+  int end;
+  std::atomic<int> *remaining;
+};
+
+// Each thread owns a deque. It takes work from the back of its own and
+// steals from the front of the others once it runs dry.
+struct TaskQueue {
+  std::mutex lock;
+  std::deque<Task> tasks;
+};
+
+// Queue 0 belongs to the VM thread, the rest to one worker each. Workers
+// are detached and never torn down, the interpreter leaves through exit()
+// from too many places to join them first.
+struct ThreadPool {
+  std::vector<TaskQueue *> queues;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+  std::atomic<int> queued{0};
+};
+
+static ThreadPool *pool = nullptr;
+
+static bool pop_task(int self, Task *task) {
+  TaskQueue *queue = pool->queues[self];
+  std::lock_guard<std::mutex> guard(queue->lock);
+  if (queue->tasks.empty())
+    return false;
+
+  *task = queue->tasks.back();
+  queue->tasks.pop_back();
+  pool->queued--;
+  return true;
+}
+
+static bool steal_task(int self, Task *task) {
+  int count = (int)pool->queues.size();
+  for (int i = 1; i < count; i++) {
+    TaskQueue *queue = pool->queues[(self + i) % count];
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->tasks.empty())
+      continue;
+
+    *task = queue->tasks.front();
+    queue->tasks.pop_front();
+    pool->queued--;
+    return true;
+  }
+  return false;
+}
+
+static bool take_task(int self, Task *task) {
+  return pop_task(self, task) || steal_task(self, task);
+}
+
+static void run_task(const Task &task) {
+  task.body(task.context, task.begin, task.end);
+  task.remaining->fetch_sub(1, std::memory_order_release);
+}
+
+static void worker_loop(int self) {
+  for (;;) {
+    Task task;
+    if (take_task(self, &task)) {
+      run_task(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(pool->sleep_lock);
+    pool->wake.wait(guard, [] { return pool->queued > 0; });
+  }
+}
+
+static void start_pool() {
+  pool = new ThreadPool();
+  int threads = PARALLEL_THREADS;
+  if (threads == 0)
+    threads = (int)std::thread::hardware_concurrency();
+  if (threads < 1)
+    threads = 1;
+
+  for (int i = 0; i < threads; i++)
+    pool->queues.push_back(new TaskQueue());
+  for (int i = 1; i < threads; i++)
+    std::thread(worker_loop, i).detach();
+}
+
+void parallel_run(int count, int grain, RangeFn body, void *context) {
+  if (count <= grain) {
+    if (count > 0)
+      body(context, 0, count);
+    return;
+  }
+  if (pool == nullptr)
+    start_pool();
+
+  int tasks = (count + grain - 1) / grain;
+  std::atomic<int> remaining{tasks};
+
+  // Deal the ranges out round robin so every thread starts with a share
+  // of its own before anyone needs to steal.
+  int threads = (int)pool->queues.size();
+  for (int i = 0; i < tasks; i++) {
+    int begin = i * grain;
+    int end = begin + grain < count ? begin + grain : count;
+    TaskQueue *queue = pool->queues[i % threads];
+    std::lock_guard<std::mutex> guard(queue->lock);
+    queue->tasks.push_back(Task{body, context, begin, end, &remaining});
+  }
+  {
+    std::lock_guard<std::mutex> guard(pool->sleep_lock);
+    pool->queued += tasks;
+  }
+  pool->wake.notify_all();
+
+  while (remaining.load(std::memory_order_acquire) > 0) {
+    Task task;
+    if (take_task(0, &task))
+      run_task(task);
+    else
+      std::this_thread::yield();
+  }
+}
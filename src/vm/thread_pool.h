@@ -0,0 +1,33 @@
+#pragma once
+
+// Ranges of this many elements are handed to one thread at a time.
+#define PARALLEL_GRAIN 16384
+
+// Threads in the pool counting the VM thread, 0 for one per hardware
+// thread.
+#ifndef PARALLEL_THREADS
+#define PARALLEL_THREADS 0
+#endif
+
+typedef void (*RangeFn)(void *context, int begin, int end);
+
+// Calls `body(context, begin, end)` for consecutive ranges of at most
+// `grain` indices covering [0, count), spread over a pool of worker
+// threads started on first use. The calling thread works too and returns
+// once every range is done.
+//
+// `body` runs off the VM thread, so it may only read and write plain
+// memory the caller set up beforehand. It must not allocate through the
+// VM, call into it or touch the GC.
+void parallel_run(int count, int grain, RangeFn body, void *context);
+
+// parallel_run() taking a lambda `body(begin, end)`.
+template <typename Fn>
+static inline void parallel_for(int count, int grain, const Fn &body) {
+  parallel_run(
+      count, grain,
+      [](void *context, int begin, int end) {
+        (*(const Fn *)context)(begin, end);
+      },
+      (void *)&body);
+}
@@ -28,10 +28,13 @@
 #include "../compiler/table.h"
 #include "../compiler/value.h"
 #include "../debug/debug.h"
+#include "../garbage_collector/gc.h"
 #include "../helper/errors.h"
+#include "../helper/mapped_file.h"
 #include "../lib/colorize.hpp"
 #include "../memory/memory.h"
 #include "../parser/chunk.h"
+#include "../parser/cache.h"
 #include "../parser/parser.h"
 #include "vm.h"
 
@@ -55,32 +58,55 @@ inline ObjFunction *get_frame_function(CallFrame *frame) {
 void init_vm() {
   reset_stack();
   vm.objects = nullptr;
+  vm.old_objects = nullptr;
+  vm.unswept = nullptr;
 
   vm.bytes_allocated = 0;
   vm.next_gc = 1024 * 1024;
+  vm.nursery_bytes = 0;
 
   vm.gray_count = 0;
   vm.gray_capacity = 0;
   vm.gray_stack = nullptr;
 
+  vm.remembered_count = 0;
+  vm.remembered_capacity = 0;
+  vm.remembered = nullptr;
+  vm.gc_minor = false;
+  vm.gc_marking = false;
+  vm.gc_step_budget = GC_STEP_BUDGET;
+
+  vm.empty_shape = nullptr;
+  vm.init_string = nullptr;
+  for (int i = 0; i < UINT8_COUNT; i++)
+    vm.char_strings[i] = nullptr;
+
   init_table(&vm.globals);
+  vm.global_slots = nullptr;
+  vm.global_count = 0;
+  vm.global_capacity = 0;
   init_table(&vm.strings);
   init_table(&vm.arrays);
 
   init_value_array(&vm.array_values);
 
-  vm.init_string = nullptr;
+  vm.method_epoch = 0;
+  vm.empty_shape = new_shape();
   vm.init_string = copy_string("init", 4);
 }
 
 void free_vm() {
   free_table(&vm.globals);
+  FREE_ARRAY(GlobalSlot, vm.global_slots, vm.global_capacity);
   free_table(&vm.strings);
   free_table(&vm.arrays);
  
   vm.init_string = nullptr;
+  vm.empty_shape = nullptr;
 
   free_objects();
+  free(vm.gray_stack);
+  free(vm.remembered);
 }
 
 void push(Value value) {
@@ -95,6 +121,49 @@ Value pop() {
 
 Value peek(int distance) { return vm.stack_top[-1 - distance]; }
 
+// Returns the slot for the global `name`, creating an undefined one the
+// first time the name is seen.
+int global_slot(ObjString *name) {
+  Value slot;
+  if (table_get(&vm.globals, name, &slot))
+    return (int)AS_NUMBER(slot);
+
+  push(OBJ_VAL(name));
+  if (vm.global_capacity < vm.global_count + 1) {
+    int old_capacity = vm.global_capacity;
+    vm.global_capacity = GROW_CAPACITY(old_capacity);
+    vm.global_slots = GROW_ARRAY(GlobalSlot, vm.global_slots, old_capacity,
+                                 vm.global_capacity);
+  }
+
+  GlobalSlot *global = &vm.global_slots[vm.global_count];
+  global->value = NIL_VAL;
+  global->defined = false;
+  global->is_static = false;
+
+  table_set(&vm.globals, name, NUMBER_VAL(vm.global_count));
+  pop();
+  return vm.global_count++;
+}
+
+// Reverse lookup for error messages and the disassembler.
+ObjString *global_name(int slot) {
+  for (int i = 0; i < vm.globals.capacity; i++) {
+    Entry *entry = &vm.globals.entries[i];
+    if (entry->key != nullptr && AS_NUMBER(entry->value) == slot)
+      return entry->key;
+  }
+  return nullptr;
+}
+
+void define_global(ObjString *name, Value value) {
+  int slot = global_slot(name);
+  GlobalSlot *global = &vm.global_slots[slot];
+  if (!global->is_static)
+    global->value = value;
+  global->defined = true;
+}
+
 bool call(Obj *callee, ObjFunction *function, int arg_count) {
   if (arg_count != function->arity) {
     string message = "Expected -> ";
@@ -175,7 +244,22 @@ bool invoke_from_class(ObjClass *klass, ObjString *name, int arg_count) {
   return call_closure(AS_CLOSURE(method), arg_count);
 }
 
-bool invoke(ObjString *name, int arg_count) {
+// Inline caches live in the function's chunk, so filling one is a store
+// into that function as far as the write barrier is concerned.
+static void cache_barrier(ObjFunction *function, InlineCache *cache) {
+  Obj *owner = (Obj *)function;
+  if (cache->shape != nullptr)
+    write_barrier(owner, OBJ_VAL((Obj *)cache->shape));
+  if (cache->transition != nullptr)
+    write_barrier(owner, OBJ_VAL((Obj *)cache->transition));
+  if (cache->klass != nullptr)
+    write_barrier(owner, OBJ_VAL((Obj *)cache->klass));
+  write_barrier(owner, cache->method);
+}
+
+// Remembers the resolved method in `cache` so the next call on an
+// instance of the same class skips the method lookup.
+bool invoke(ObjString *name, int arg_count, InlineCache *cache) {
   Value receiver = peek(arg_count);
 
   if (!IS_INSTANCE(receiver)) {
@@ -183,8 +267,19 @@ bool invoke(ObjString *name, int arg_count) {
     return false;
   }
 
-  ObjInstance *instance = AS_INSTANCE(receiver);
-  return invoke_from_class(instance->klass, name, arg_count);
+  ObjClass *klass = AS_INSTANCE(receiver)->klass;
+  if (cache->klass == klass && cache->epoch == vm.method_epoch)
+    return call_closure(AS_CLOSURE(cache->method), arg_count);
+
+  Value method;
+  if (!table_get(&klass->methods, name, &method))
+    return invoke_from_class(klass, name, arg_count);
+
+  cache->klass = klass;
+  cache->method = method;
+  cache->epoch = vm.method_epoch;
+  cache_barrier(vm.frames[vm.frame_count - 1].closure->function, cache);
+  return call_closure(AS_CLOSURE(method), arg_count);
 }
 
 bool bind_method(ObjClass *klass, ObjString *name) {
@@ -229,6 +324,7 @@ void close_upvalues(Value *last) {
     ObjUpvalue *upvalue = vm.open_upvalues;
     upvalue->closed = *upvalue->location;
     upvalue->location = &upvalue->closed;
+    write_barrier((Obj *)upvalue, upvalue->closed);
     vm.open_upvalues = upvalue->next;
   }
 }
@@ -237,8 +333,11 @@ void define_method(ObjString *name) {
   Value method = peek(0);
   ObjClass *klass = AS_CLASS(peek(1));
   table_set(&klass->methods, name, method);
+  write_barrier((Obj *)klass, OBJ_VAL(name));
+  write_barrier((Obj *)klass, method);
   if (name == vm.init_string)
     klass->initializer = method;
+  vm.method_epoch++;
   pop();
 }
 
@@ -246,17 +345,40 @@ bool is_falsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+// Short results are copied and interned, anything longer becomes a rope
+// so building a string in a loop doesn't copy it on every step.
 void concatenate() {
-  ObjString *b = AS_STRING(peek(0));
-  ObjString *a = AS_STRING(peek(1));
-
-  int length = a->length + b->length;
-  char *chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
-
-  ObjString *result = take_string(chars, length);
+  Value b = peek(0);
+  Value a = peek(1);
+  int length = string_length(a) + string_length(b);
+
+  Obj *result;
+  if (length < ROPE_MIN_LENGTH) {
+    // Ropes are never this short, so both sides are flat already.
+    ObjString *left = AS_STRING(a);
+    ObjString *right = AS_STRING(b);
+    ObjString *string = new_string(length);
+    memcpy(string->chars, left->chars, left->length);
+    memcpy(string->chars + left->length, right->chars, right->length);
+    result = (Obj *)intern_string(string);
+  } else if (IS_ROPE(a) && AS_ROPE(a)->flat == nullptr && !IS_ROPE(b) &&
+             AS_ROPE(a)->right->type == OBJ_STRING &&
+             ((ObjString *)AS_ROPE(a)->right)->length + string_length(b) <
+                 ROPE_MIN_LENGTH) {
+    // Appending a short piece: copy it next to the rope's last leaf rather
+    // than adding a node per piece. Leaves are never seen by the program,
+    // so the merged one isn't interned.
+    ObjString *tail = (ObjString *)AS_ROPE(a)->right;
+    ObjString *piece = AS_STRING(b);
+    ObjString *leaf = new_string(tail->length + piece->length);
+    memcpy(leaf->chars, tail->chars, tail->length);
+    memcpy(leaf->chars + tail->length, piece->chars, piece->length);
+    push(OBJ_VAL(leaf));
+    result = (Obj *)new_rope(AS_ROPE(a)->left, (Obj *)leaf);
+    pop();
+  } else {
+    result = (Obj *)new_rope(AS_OBJ(a), AS_OBJ(b));
+  }
   pop();
   pop();
   push(OBJ_VAL(result));
@@ -266,7 +388,7 @@ unordered_set<ObjString *> loadedModules;
 unordered_set<ObjString *> loadingModules;
 vector<ObjString *> circularDependence;
 
-ObjModule *load_module(ObjString *name) {
+void load_module(ObjString *name) {
   // Check if the module is already being loaded
   if (loadingModules.find(name) != loadingModules.end()) {
     // Circular dependency detected, collect all modules involved
@@ -297,8 +419,8 @@ ObjModule *load_module(ObjString *name) {
   string moduleFileName = string(name->chars, name->length);
   moduleFileName += ".zu";
 
-  FILE *file = fopen(moduleFileName.c_str(), "rb");
-  if (!file) {
+  MappedFile source;
+  if (!open_mapped_file(moduleFileName.c_str(), &source)) {
     std::string errorMessage = "Could not load file -> '";
     errorMessage += moduleFileName;
     errorMessage += "'";
@@ -306,36 +428,24 @@ ObjModule *load_module(ObjString *name) {
     ZuraExit(VM_ERROR);
   }
 
-  std::vector<char> buffer;
-  char chunk[1024];
-  while (size_t bytesRead = fread(chunk, 1, sizeof(chunk), file)) {
-    buffer.insert(buffer.end(), chunk, chunk + bytesRead);
-  }
-  fclose(file);
-
-  string source(buffer.begin(), buffer.end());
-
-  InterpretResult result = interpret(source.c_str());
+  InterpretResult result =
+      interpret_file(moduleFileName.c_str(), source.chars);
+  close_mapped_file(&source);
   if (result != INTERPRET_OK) {
     runtime_error("Error loading module!");
     ZuraExit(VM_ERROR);
   }
 
-  // Finished loading the module, remove it from loadingModules
+  // Finished loading the module, remove it from loadingModules. Its
+  // top-level definitions were made straight into vm.globals.
   loadingModules.erase(name);
-
-  // Add the module globals to the global table
-  ObjModule *module = AS_MODULE(pop());
-  table_add_all(&module->variables, &vm.globals);
-
-  return module;
 }
 
 static InterpretResult run() {
 #ifndef DEBUG_TRACE_EXECUTION
-  auto print_stack = []() {
+  auto print_stack = [](Value *top) {
     cout << "          ";
-    for (Value *slot = vm.stack; slot < vm.stack_top; slot++) {
+    for (Value *slot = vm.stack; slot < top; slot++) {
       printf("[ ");
       print_value(*slot);
       printf(" ]");
@@ -344,588 +454,875 @@ static InterpretResult run() {
   };
 #endif
 
-  CallFrame *frame = &vm.frames[vm.frame_count - 1];
+  // The hot interpreter state lives in locals so the compiler can keep it
+  // in registers. `frame->ip` and `vm.stack_top` are only brought up to
+  // date (STORE_FRAME) before anything that can look at them: calls,
+  // returns, allocations that may collect and runtime errors.
+  CallFrame *frame;
+  OpCode *ip;
+  Value *slots;
+  Value *sp;
+  // Constant index of instructions that also have a _LONG form.
+  uint32_t operand;
+
+  // run() is re-entered for imported modules, and must hand control back
+  // once the frame it was started for returns.
+  int base_frame_count = vm.frame_count - 1;
+
+#define STORE_FRAME()                                                          \
+  do {                                                                         \
+    frame->ip = ip;                                                            \
+    vm.stack_top = sp;                                                         \
+  } while (false)
+
+#define LOAD_FRAME()                                                           \
+  do {                                                                         \
+    frame = &vm.frames[vm.frame_count - 1];                                    \
+    ip = frame->ip;                                                            \
+    slots = frame->slots;                                                      \
+    sp = vm.stack_top;                                                         \
+  } while (false)
+
+  LOAD_FRAME();
+
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
 
-#define read_byte() (*frame->ip++)
+#define read_byte() (*ip++)
 #define read_short()                                                           \
-  (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+  (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define read_long()                                                            \
+  (ip += 3, (uint32_t)((ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
 #define read_constant()                                                        \
   (frame->closure->function->chunk.constants.values[read_byte()])
+#define operand_constant()                                                     \
+  (frame->closure->function->chunk.constants.values[operand])
+#define read_cache()                                                           \
+  (&frame->closure->function->chunk.caches[read_short()])
+
+#define RUNTIME_ERROR(...)                                                     \
+  do {                                                                         \
+    STORE_FRAME();                                                             \
+    runtimeError(__VA_ARGS__);                                                 \
+    return INTERPRET_RUNTIME_ERROR;                                            \
+  } while (false)
 
 #define BINARY_OP(value_type, op)                                              \
   do {                                                                         \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
-      runtimeError("Operands must be numbers\n");                              \
-      return INTERPRET_RUNTIME_ERROR;                                          \
-    }                                                                          \
-    double b = AS_NUMBER(pop());                                               \
-    double a = AS_NUMBER(pop());                                               \
-    push(value_type(a op b));                                                  \
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))                            \
+      RUNTIME_ERROR("Operands must be numbers\n");                             \
+    double b = AS_NUMBER(POP());                                               \
+    double a = AS_NUMBER(POP());                                               \
+    PUSH(value_type(a op b));                                                  \
   } while (false)
 
 #define MODULO_OP(value_type, op)                                              \
   do {                                                                         \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
-      runtimeError("Operands must be numbers\n");                              \
-      return INTERPRET_RUNTIME_ERROR;                                          \
-    }                                                                          \
-    double b = AS_NUMBER(pop());                                               \
-    double a = AS_NUMBER(pop());                                               \
-    push(value_type(fmod(a, b)));                                              \
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))                            \
+      RUNTIME_ERROR("Operands must be numbers\n");                             \
+    double b = AS_NUMBER(POP());                                               \
+    double a = AS_NUMBER(POP());                                               \
+    PUSH(value_type(fmod(a, b)));                                              \
   } while (false)
 
 #define POW_OP(value_type, op)                                                 \
   do {                                                                         \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
-      runtimeError("Operands must be numbers\n");                              \
-      return INTERPRET_RUNTIME_ERROR;                                          \
-    }                                                                          \
-    double b = AS_NUMBER(pop());                                               \
-    double a = AS_NUMBER(pop());                                               \
-    push(value_type(pow(a, b)));                                               \
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))                            \
+      RUNTIME_ERROR("Operands must be numbers\n");                             \
+    double b = AS_NUMBER(POP());                                               \
+    double a = AS_NUMBER(POP());                                               \
+    PUSH(value_type(pow(a, b)));                                               \
   } while (false)
 
-  for (;;) {
 #ifndef DEBUG_TRACE_EXECUTION
-    print_stack();
-    disassemble_instruction(
-        &frame->closure->function->chunk,
-        (int)(reinterpret_cast<uint8_t*>(frame->ip) - frame->closure->function->chunk.code));
+#define TRACE_INSTRUCTION()                                                    \
+  do {                                                                         \
+    print_stack(sp);                                                           \
+    disassemble_instruction(                                                   \
+        &frame->closure->function->chunk,                                      \
+        (int)(reinterpret_cast<uint8_t *>(ip) -                                \
+              frame->closure->function->chunk.code));                          \
+  } while (false)
+#else
+#define TRACE_INSTRUCTION() do {} while (false)
+#endif
+
+#ifdef COMPUTED_GOTO
+  // Every handler jumps straight to the next one through this table, so
+  // each opcode gets its own indirect branch instead of sharing the one
+  // at the top of a switch. Slots are filled by opcode rather than by
+  // position so the table can't drift out of order with `OpCode`.
+  static void *dispatch_table[UINT8_COUNT];
+  static bool dispatch_ready = false;
+
+  if (!dispatch_ready) {
+    for (int i = 0; i < UINT8_COUNT; i++)
+      dispatch_table[i] = &&code_unknown;
+
+#define SET_LABEL(op) dispatch_table[op] = &&code_##op
+    SET_LABEL(OP_CONSTANT);
+    SET_LABEL(OP_GET_GLOBAL);
+    SET_LABEL(OP_SET_GLOBAL);
+    SET_LABEL(OP_DEFINE_GLOBAL);
+    SET_LABEL(OP_GET_STATIC);
+    SET_LABEL(OP_DEFINE_STATIC);
+    SET_LABEL(OP_GET_LOCAL);
+    SET_LABEL(OP_SET_LOCAL);
+    SET_LABEL(OP_GET_UPVALUE);
+    SET_LABEL(OP_SET_UPVALUE);
+    SET_LABEL(OP_GET_PROPERTY);
+    SET_LABEL(OP_SET_PROPERTY);
+    SET_LABEL(OP_GET_SUPER);
+    SET_LABEL(OP_SUPER_INVOKE);
+    SET_LABEL(OP_ARRAY);
+    SET_LABEL(OP_INDEX);
+    SET_LABEL(OP_ADD_ELEM);
+    SET_LABEL(OP_REMOVE_ELEM);
+    SET_LABEL(OP_ADD);
+    SET_LABEL(OP_SUBTRACT);
+    SET_LABEL(OP_MULTIPLY);
+    SET_LABEL(OP_DIVIDE);
+    SET_LABEL(OP_MODULO);
+    SET_LABEL(OP_POWER);
+    SET_LABEL(OP_INCREMENT);
+    SET_LABEL(OP_DECREMENT);
+    SET_LABEL(OP_NIL);
+    SET_LABEL(OP_TRUE);
+    SET_LABEL(OP_FALSE);
+    SET_LABEL(OP_EQUAL);
+    SET_LABEL(OP_GREATER);
+    SET_LABEL(OP_LESS);
+    SET_LABEL(OP_NOT);
+    SET_LABEL(OP_NEGATE);
+    SET_LABEL(OP_RETURN);
+    SET_LABEL(OP_CLOSURE);
+    SET_LABEL(OP_CLOSE_UPVALUE);
+    SET_LABEL(OP_JUMP_IF_FALSE);
+    SET_LABEL(OP_JUMP);
+    SET_LABEL(OP_LOOP);
+    SET_LABEL(OP_BREAK);
+    SET_LABEL(OP_CALL);
+    SET_LABEL(OP_INVOKE);
+    SET_LABEL(OP_INHERIT);
+    SET_LABEL(OP_DUP);
+    SET_LABEL(OP_METHOD);
+    SET_LABEL(OP_IMPORT);
+    SET_LABEL(OP_SLEEP);
+    SET_LABEL(OP_EXIT);
+    SET_LABEL(OP_CLASS);
+    SET_LABEL(OP_INPUT);
+    SET_LABEL(OP_INFO);
+    SET_LABEL(OP_POP);
+    SET_LABEL(OP_GET_LOCAL_LOCAL);
+    SET_LABEL(OP_ADD_LOCAL_CONSTANT);
+    SET_LABEL(OP_LESS_JUMP_IF_FALSE);
+    SET_LABEL(OP_GREATER_JUMP_IF_FALSE);
+    SET_LABEL(OP_CONSTANT_LONG);
+    SET_LABEL(OP_GET_PROPERTY_LONG);
+    SET_LABEL(OP_SET_PROPERTY_LONG);
+    SET_LABEL(OP_GET_SUPER_LONG);
+    SET_LABEL(OP_SUPER_INVOKE_LONG);
+    SET_LABEL(OP_INVOKE_LONG);
+    SET_LABEL(OP_CLOSURE_LONG);
+    SET_LABEL(OP_METHOD_LONG);
+    SET_LABEL(OP_CLASS_LONG);
+#undef SET_LABEL
+
+    dispatch_ready = true;
+  }
+
+#define INTERPRET_LOOP DISPATCH();
+#define CASE_CODE(op) code_##op
+#define CASE_DEFAULT code_unknown
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    TRACE_INSTRUCTION();                                                       \
+    goto *dispatch_table[read_byte()];                                         \
+  } while (false)
+#else
+#define INTERPRET_LOOP                                                         \
+  loop:                                                                        \
+  TRACE_INSTRUCTION();                                                         \
+  switch (read_byte())
+#define CASE_CODE(op) case op
+#define CASE_DEFAULT default
+#define DISPATCH() goto loop
 #endif
 
-    OpCode instruction;
-    switch (instruction = read_byte()) {
-    case OP_CONSTANT: {
+  INTERPRET_LOOP {
+    CASE_CODE(OP_CONSTANT): {
       Value constant = read_constant();
-      push(constant);
-      break;
+      PUSH(constant);
+      DISPATCH();
+    }
+    CASE_CODE(OP_CONSTANT_LONG): {
+      operand = read_long();
+      PUSH(operand_constant());
+      DISPATCH();
     }
 
-    case OP_SLEEP: {
-      Value duration = peek(0);
+    CASE_CODE(OP_SLEEP): {
+      Value duration = PEEK(0);
       if (!IS_NUMBER(duration)) {
-        runtimeError("Duration must be a number in seconds\n");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Duration must be a number in seconds\n");
       }
       sleep(AS_NUMBER(duration));
+      STORE_FRAME();
       table_add_all(&vm.globals, &vm.arrays);
-      break;
+      DISPATCH();
     }
 
-    case OP_EXIT: {
-      Value exit_code = peek(0);
+    CASE_CODE(OP_EXIT): {
+      Value exit_code = PEEK(0);
       if (!IS_NUMBER(exit_code)) {
-        runtimeError("Exit code must be a number\n");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Exit code must be a number\n");
       }
       // TODO Calls Value's double member variable
       exit((int)AS_NUMBER(exit_code));
     }
 
     // Global variable operation codes
-    case OP_SET_GLOBAL: {
-      ObjString *name = AS_STRING(read_constant());
+    CASE_CODE(OP_SET_GLOBAL): {
+      int slot = read_short();
+      GlobalSlot *global = &vm.global_slots[slot];
 
-      if (table_get(&vm.statics, name, nullptr)) {
+      if (global->is_static) {
         string message = "Cannot assign to static variable -> ";
-        message += string(name->chars, name->length);
-        runtimeError(message.c_str());
-        return INTERPRET_RUNTIME_ERROR;
+        message += global_name(slot)->chars;
+        RUNTIME_ERROR(message.c_str());
       }
-
-      if (table_set(&vm.globals, name, peek(0))) {
-        table_delete(&vm.globals, name);
+      if (!global->defined) {
         string message = "Undefined variable -> ";
-        message += string(name->chars, name->length);
-        runtimeError(message.c_str());
-        return INTERPRET_RUNTIME_ERROR;
+        message += global_name(slot)->chars;
+        RUNTIME_ERROR(message.c_str());
       }
-      break;
-    }
-    case OP_GET_GLOBAL: {
-      ObjString *name = AS_STRING(read_constant());
-      Value value;
 
-      // check if its a static variable
-      if (table_get(&vm.statics, name, &value)) {
-        push(value);
-        break;
-      }
+      global->value = PEEK(0);
+      DISPATCH();
+    }
+    CASE_CODE(OP_GET_GLOBAL): {
+      int slot = read_short();
+      GlobalSlot *global = &vm.global_slots[slot];
 
-      if (!table_get(&vm.globals, name, &value)) {
+      if (!global->defined) {
         string message = "Undefined variable -> ";
-        message += string(name->chars, name->length);
-        runtimeError(message.c_str());
-        return INTERPRET_RUNTIME_ERROR;
+        message += global_name(slot)->chars;
+        RUNTIME_ERROR(message.c_str());
       }
 
-      push(value);
-      break;
+      PUSH(global->value);
+      DISPATCH();
     }
-    case OP_DEFINE_GLOBAL: {
-      ObjString *name = AS_STRING(read_constant());
-      table_set(&vm.globals, name, peek(0));
-      pop();
-      break;
+    CASE_CODE(OP_DEFINE_GLOBAL): {
+      GlobalSlot *global = &vm.global_slots[read_short()];
+      // A static of the same name keeps shadowing the global.
+      if (!global->is_static)
+        global->value = PEEK(0);
+      global->defined = true;
+      sp--;
+      DISPATCH();
     }
 
     // Static variable operation codes
-    case OP_GET_STATIC: {
-      ObjString *name = AS_STRING(read_constant());
-      Value value;
-      if (!table_get(&vm.statics, name, &value)) {
+    CASE_CODE(OP_GET_STATIC): {
+      int slot = read_short();
+      GlobalSlot *global = &vm.global_slots[slot];
+
+      if (!global->is_static) {
         string message = "Undefined variable -> ";
-        message += string(name->chars, name->length);
-        runtimeError(message.c_str());
-        return INTERPRET_RUNTIME_ERROR;
+        message += global_name(slot)->chars;
+        RUNTIME_ERROR(message.c_str());
       }
-      push(value);
-      break;
+      PUSH(global->value);
+      DISPATCH();
     }
 
-    case OP_DEFINE_STATIC: {
-      ObjString *name = AS_STRING(read_constant());
-      table_set(&vm.statics, name, peek(0));
-      pop();
-      break;
+    CASE_CODE(OP_DEFINE_STATIC): {
+      GlobalSlot *global = &vm.global_slots[read_short()];
+      global->value = PEEK(0);
+      global->defined = true;
+      global->is_static = true;
+      sp--;
+      DISPATCH();
     }
 
     // Local variable operation codes
-    case OP_GET_LOCAL: {
+    CASE_CODE(OP_GET_LOCAL): {
       uint8_t slot = read_byte();
-      push(frame->slots[slot]);
-      break;
+      PUSH(slots[slot]);
+      DISPATCH();
     }
-    case OP_SET_LOCAL: {
+    CASE_CODE(OP_SET_LOCAL): {
       uint8_t slot = read_byte();
-      frame->slots[slot] = peek(0);
-      break;
+      slots[slot] = PEEK(0);
+      DISPATCH();
+    }
+    CASE_CODE(OP_GET_LOCAL_LOCAL): {
+      uint8_t first = read_byte();
+      uint8_t second = read_byte();
+      PUSH(slots[first]);
+      PUSH(slots[second]);
+      DISPATCH();
     }
 
     // Upvalue operation codes
-    case OP_GET_UPVALUE: {
+    CASE_CODE(OP_GET_UPVALUE): {
       uint8_t slot = read_byte();
-      push(*frame->closure->upvalues[slot]->location);
-      break;
+      PUSH(*frame->closure->upvalues[slot]->location);
+      DISPATCH();
     }
-    case OP_SET_UPVALUE: {
-      uint8_t slot = read_byte();
-      *frame->closure->upvalues[slot]->location = peek(0);
-      break;
+    CASE_CODE(OP_SET_UPVALUE): {
+      ObjUpvalue *upvalue = frame->closure->upvalues[read_byte()];
+      *upvalue->location = PEEK(0);
+      write_barrier((Obj *)upvalue, PEEK(0));
+      DISPATCH();
     }
     // Property operations codes
-    case OP_GET_PROPERTY: {
-      if (!IS_INSTANCE(peek(0))) {
-        runtimeError("Only instance have properties");
-        return INTERPRET_RUNTIME_ERROR;
+    CASE_CODE(OP_GET_PROPERTY_LONG):
+      operand = read_long();
+      goto op_get_property;
+    CASE_CODE(OP_GET_PROPERTY):
+      operand = read_byte();
+    op_get_property: {
+      if (!IS_INSTANCE(PEEK(0))) {
+        RUNTIME_ERROR("Only instance have properties");
       }
-      ObjInstance *instance = AS_INSTANCE(peek(0));
-      ObjString *name = AS_STRING(read_constant());
+      ObjInstance *instance = AS_INSTANCE(PEEK(0));
+      ObjString *name = AS_STRING(operand_constant());
+      InlineCache *cache = read_cache();
 
-      Value value;
-      if (table_get(&instance->fields, name, &value)) {
-        pop(); // Instance
-        push(value);
-        break;
+      if (cache->shape == instance->shape) {
+        PEEK(0) = instance->fields[cache->slot];
+        DISPATCH();
       }
 
+      int slot = shape_find_slot(instance->shape, name);
+      if (slot >= 0) {
+        cache->shape = instance->shape;
+        cache->transition = nullptr;
+        cache->slot = slot;
+        cache_barrier(frame->closure->function, cache);
+        PEEK(0) = instance->fields[slot];
+        DISPATCH();
+      }
+
+      STORE_FRAME();
       if (!bind_method(instance->klass, name))
         return INTERPRET_RUNTIME_ERROR;
-      break;
+      LOAD_FRAME();
+      DISPATCH();
     }
-    case OP_SET_PROPERTY: {
-      if (!IS_INSTANCE(peek(1))) {
-        runtimeError("Only instances have fields");
-        return INTERPRET_RUNTIME_ERROR;
+    CASE_CODE(OP_SET_PROPERTY_LONG):
+      operand = read_long();
+      goto op_set_property;
+    CASE_CODE(OP_SET_PROPERTY):
+      operand = read_byte();
+    op_set_property: {
+      if (!IS_INSTANCE(PEEK(1))) {
+        RUNTIME_ERROR("Only instances have fields");
       }
-      ObjInstance *instance = AS_INSTANCE(peek(1));
-      table_set(&instance->fields, AS_STRING(read_constant()), peek(0));
-      Value value = pop();
-      pop();
-      push(value);
-      break;
+      ObjInstance *instance = AS_INSTANCE(PEEK(1));
+      ObjString *name = AS_STRING(operand_constant());
+      InlineCache *cache = read_cache();
+
+      if (cache->shape == instance->shape) {
+        if (cache->transition != nullptr) {
+          // Adding the same field another instance of this shape gained.
+          if (cache->slot >= instance->field_capacity) {
+            STORE_FRAME();
+            instance_reserve(instance,
+                             GROW_CAPACITY(instance->field_capacity));
+          }
+          instance->shape = cache->transition;
+          write_barrier((Obj *)instance, OBJ_VAL((Obj *)instance->shape));
+          // The cache follows shapes, which classes share, so this may be
+          // the first time this instance's class sees the field.
+          if (instance->klass->field_hint < instance->shape->field_count)
+            instance->klass->field_hint = instance->shape->field_count;
+        }
+        instance->fields[cache->slot] = PEEK(0);
+        write_barrier((Obj *)instance, PEEK(0));
+      } else {
+        ObjShape *shape = instance->shape;
+        STORE_FRAME();
+        instance_set_field(instance, name, PEEK(0));
+        cache->shape = shape;
+        cache->transition = shape == instance->shape ? nullptr : instance->shape;
+        cache->slot = shape_find_slot(instance->shape, name);
+        cache_barrier(frame->closure->function, cache);
+      }
+      Value value = POP();
+      sp--;
+      PUSH(value);
+      DISPATCH();
     }
     // Super operation codes
-    case OP_GET_SUPER: {
-      ObjString *name = AS_STRING(read_constant());
-      ObjClass *superclass = AS_CLASS(pop());
+    CASE_CODE(OP_GET_SUPER_LONG):
+      operand = read_long();
+      goto op_get_super;
+    CASE_CODE(OP_GET_SUPER):
+      operand = read_byte();
+    op_get_super: {
+      ObjString *name = AS_STRING(operand_constant());
+      ObjClass *superclass = AS_CLASS(POP());
+      STORE_FRAME();
       if (!bind_method(superclass, name))
         return INTERPRET_RUNTIME_ERROR;
-      break;
+      LOAD_FRAME();
+      DISPATCH();
     }
-    case OP_SUPER_INVOKE: {
-      ObjString *method = AS_STRING(read_constant());
+    CASE_CODE(OP_SUPER_INVOKE_LONG):
+      operand = read_long();
+      goto op_super_invoke;
+    CASE_CODE(OP_SUPER_INVOKE):
+      operand = read_byte();
+    op_super_invoke: {
+      ObjString *method = AS_STRING(operand_constant());
       int arg_count = read_byte();
-      ObjClass *superclass = AS_CLASS(pop());
+      ObjClass *superclass = AS_CLASS(POP());
+      STORE_FRAME();
       if (!invoke_from_class(superclass, method, arg_count))
         return INTERPRET_RUNTIME_ERROR;
-      frame = &vm.frames[vm.frame_count - 1];
-      break;
+      LOAD_FRAME();
+      DISPATCH();
     }
     // Array operation codes
-    case OP_ARRAY: {
+    CASE_CODE(OP_ARRAY): {
       int count = read_byte();
+      STORE_FRAME();
       ObjArray* array = new_array();
+      PUSH(ARRAY_VAL(array));
+      vm.stack_top = sp;
 
       for (int i = 0; i < count; i++) {
-        if (IS_STRING(peek(count - i - 1)) && IS_NUMBER(peek(count - i - 2))) {
-          runtimeError("Cannot mix strings and numbers in an array");
-          return INTERPRET_RUNTIME_ERROR;
+        if (IS_STRING(PEEK(count - i)) && IS_NUMBER(PEEK(count - i - 1))) {
+          RUNTIME_ERROR("Cannot mix strings and numbers in an array");
         }
-        array_write(array, i, peek(count - i - 1));
+        array_write(array, i, PEEK(count - i));
       }
 
-      for (int i = 0; i < count; i++) { pop(); }
-      push(ARRAY_VAL(array));
-      break;
+      sp -= count + 1;
+      PUSH(ARRAY_VAL(array));
+      DISPATCH();
     }
-    case OP_INDEX: {
-      Value index = peek(0);
-      Value array = peek(1);
+    CASE_CODE(OP_INDEX): {
+      Value index = PEEK(0);
+      Value array = PEEK(1);
 
       // Check to whether we are index a string or an array
       if (IS_STRING(array)) {
+        // AS_STRING flattens ropes, which allocates.
+        STORE_FRAME();
         ObjString* str = AS_STRING(array);
 
         if (!IS_NUMBER(index)) {
-          runtimeError("Only numbers can be used as indexes");
-          return INTERPRET_RUNTIME_ERROR;
+          RUNTIME_ERROR("Only numbers can be used as indexes");
         }
 
         // print the character at the index
         int idx = static_cast<int>(AS_NUMBER(index));
 
         if (idx < 0 || idx >= str->length) {
-          runtimeError("Index out of bounds");
-          return INTERPRET_RUNTIME_ERROR;
+          RUNTIME_ERROR("Index out of bounds");
         }
 
-        pop();
-        pop();
-        push(OBJ_VAL(copy_string(&str->chars[idx], 1)));
-        break;
+        Value character = OBJ_VAL(copy_string(&str->chars[idx], 1));
+        sp -= 2;
+        PUSH(character);
+        DISPATCH();
       }
 
       if (!IS_ARRAY(array)) {
-        runtimeError("Only arrays have indexes");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Only arrays have indexes");
       }
 
       ObjArray* arr = AS_ARRAY(array);
 
       if (!IS_NUMBER(index)) {
-        runtimeError("Only numbers can be used as indexes");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Only numbers can be used as indexes");
       }
 
       int idx = static_cast<int>(AS_NUMBER(index));
 
       if (idx < 0 || idx >= arr->count) {
-        runtimeError("Index out of bounds");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Index out of bounds");
       }
 
-      pop();
-      pop();
-      push(arr->values[idx]);
-      break;
+      sp -= 2;
+      PUSH(arr->values[idx]);
+      DISPATCH();
     }
-    case OP_ADD_ELEM: {
-      double value = AS_NUMBER(peek(1));
-      double index = AS_NUMBER(peek(0));
+    CASE_CODE(OP_ADD_ELEM): {
+      Value value = PEEK(1);
+      double index = AS_NUMBER(PEEK(0));
 
-      if (!IS_ARRAY(peek(2))) {
-        runtimeError("Only arrays have indexes");
-        return INTERPRET_RUNTIME_ERROR;
+      if (!IS_ARRAY(PEEK(2))) {
+        RUNTIME_ERROR("Only arrays have indexes");
       }
 
-      ObjArray* arr = AS_ARRAY(peek(2));
+      ObjArray* arr = AS_ARRAY(PEEK(2));
 
-      if (!IS_NUMBER(peek(0))) {
-        runtimeError("Only numbers can be used as indexes");
-        return INTERPRET_RUNTIME_ERROR;
+      if (!IS_NUMBER(PEEK(0))) {
+        RUNTIME_ERROR("Only numbers can be used as indexes");
       }
 
       int idx = static_cast<int>(index);
 
       if (idx < 0 || idx > arr->count) {
-        runtimeError("Index out of bounds");
-        return INTERPRET_RUNTIME_ERROR;
-      }
-
-      // Shift elements to the right to make space for the new element
-      for (int i = arr->count; i > idx; i--) {
-        arr->values[i] = arr->values[i - 1];
+        RUNTIME_ERROR("Index out of bounds");
       }
 
-      arr->values[idx] = NUMBER_VAL(value);
-      arr->count++;
+      STORE_FRAME();
+      array_insert(arr, idx, value);
 
-      pop();
-      pop();
-      pop();
-      push(ARRAY_VAL(arr));
-      break;
+      sp -= 3;
+      PUSH(ARRAY_VAL(arr));
+      DISPATCH();
     }
-    case OP_REMOVE_ELEM: {
-      Value index = peek(0);
-      Value array = peek(1);
+    CASE_CODE(OP_REMOVE_ELEM): {
+      Value index = PEEK(0);
+      Value array = PEEK(1);
 
       if (!IS_ARRAY(array)) {
-        runtimeError("Only arrays have indexes");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Only arrays have indexes");
       }
 
       ObjArray* arr = AS_ARRAY(array);
 
       if (!IS_NUMBER(index)) {
-        runtimeError("Only numbers can be used as indexes");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Only numbers can be used as indexes");
       }
 
       int idx = static_cast<int>(AS_NUMBER(index));
 
       if (idx < 0 || idx >= arr->count) {
-        runtimeError("Index out of bounds");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Index out of bounds");
       }
 
-      pop();
-      pop();
-
-      for (int i = idx; i < arr->count - 1; i++) {
-        arr->values[i] = arr->values[i + 1];
-      }
-
-      arr->count--;
-      push(ARRAY_VAL(arr));
-      break;
+      sp -= 2;
+      array_remove(arr, idx);
+      PUSH(ARRAY_VAL(arr));
+      DISPATCH();
     }
     // Bool operation codes
-    case OP_TRUE:
-      push(BOOL_VAL(true));
-      break;
-    case OP_FALSE:
-      push(BOOL_VAL(false));
-      break;
-    case OP_NIL:
-      push(NIL_VAL);
-      break;
-    case OP_POP:
-      pop();
-      break;
+    CASE_CODE(OP_TRUE):
+      PUSH(BOOL_VAL(true));
+      DISPATCH();
+    CASE_CODE(OP_FALSE):
+      PUSH(BOOL_VAL(false));
+      DISPATCH();
+    CASE_CODE(OP_NIL):
+      PUSH(NIL_VAL);
+      DISPATCH();
+    CASE_CODE(OP_POP):
+      sp--;
+      DISPATCH();
 
     // Comparison operation codes
-    case OP_EQUAL: {
-      Value b = pop();
-      Value a = pop();
-      push(BOOL_VAL(values_equal(a, b)));
-      break;
+    CASE_CODE(OP_EQUAL): {
+      // Comparing a rope flattens it, keep both operands on the stack
+      // until that's done.
+      STORE_FRAME();
+      bool equal = values_equal(PEEK(1), PEEK(0));
+      sp -= 2;
+      PUSH(BOOL_VAL(equal));
+      DISPATCH();
     }
-    case OP_GREATER:
+    CASE_CODE(OP_GREATER):
       BINARY_OP(BOOL_VAL, >);
-      break;
-    case OP_LESS:
+      DISPATCH();
+    CASE_CODE(OP_LESS):
       BINARY_OP(BOOL_VAL, <);
-      break;
+      DISPATCH();
+
+    CASE_CODE(OP_LESS_JUMP_IF_FALSE): {
+      uint16_t offset = read_short();
+      if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+        RUNTIME_ERROR("Operands must be numbers\n");
+      double b = AS_NUMBER(POP());
+      double a = AS_NUMBER(POP());
+      if (!(a < b)) {
+        PUSH(BOOL_VAL(false));
+        ip += offset;
+      }
+      DISPATCH();
+    }
+    CASE_CODE(OP_GREATER_JUMP_IF_FALSE): {
+      uint16_t offset = read_short();
+      if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+        RUNTIME_ERROR("Operands must be numbers\n");
+      double b = AS_NUMBER(POP());
+      double a = AS_NUMBER(POP());
+      if (!(a > b)) {
+        PUSH(BOOL_VAL(false));
+        ip += offset;
+      }
+      DISPATCH();
+    }
 
     // Math operation codes
-    case OP_ADD: {
-      if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+    CASE_CODE(OP_ADD_LOCAL_CONSTANT): {
+      Value a = slots[read_byte()];
+      Value b = read_constant();
+      if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        PUSH(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+        DISPATCH();
+      }
+      // Strings and arrays take the generic path.
+      PUSH(a);
+      PUSH(b);
+      goto add_values;
+    }
+    CASE_CODE(OP_ADD): {
+    add_values:
+      if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+        STORE_FRAME();
         concatenate();
-      } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-        double b = AS_NUMBER(pop());
-        double a = AS_NUMBER(pop());
-        push(NUMBER_VAL(a + b));
-      } else if (IS_ARRAY(peek(0)) && IS_ARRAY(peek(1))) {
-        ObjArray* b = AS_ARRAY(pop());
-        ObjArray* a = AS_ARRAY(pop());
+        sp = vm.stack_top;
+      } else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+        double b = AS_NUMBER(POP());
+        double a = AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a + b));
+      } else if (IS_ARRAY(PEEK(0)) && IS_ARRAY(PEEK(1))) {
+        ObjArray* b = AS_ARRAY(PEEK(0));
+        ObjArray* a = AS_ARRAY(PEEK(1));
+        STORE_FRAME();
         ObjArray* array = new_array();
+        PUSH(ARRAY_VAL(array));
+        vm.stack_top = sp;
 
-        for (int i = 0; i < a->count; i++) {
-          array_write(array, i, a->values[i]);
-        }
-
-        for (int i = 0; i < b->count; i++) {
-          array_write(array, a->count + i, b->values[i]);
-        }
+        array_reserve(array, a->count + b->count);
+        array_append(array, a);
+        array_append(array, b);
 
-        push(ARRAY_VAL(array));
+        sp -= 3;
+        PUSH(ARRAY_VAL(array));
       } else {
-        runtimeError("Operands must be two numbers or two strings\n");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Operands must be two numbers or two strings\n");
       }
-      break;
+      DISPATCH();
     }
-    case OP_SUBTRACT:
+    CASE_CODE(OP_SUBTRACT):
       BINARY_OP(NUMBER_VAL, -);
-      break;
-    case OP_MULTIPLY:
+      DISPATCH();
+    CASE_CODE(OP_MULTIPLY):
       BINARY_OP(NUMBER_VAL, *);
-      break;
-    case OP_DIVIDE:
+      DISPATCH();
+    CASE_CODE(OP_DIVIDE):
       BINARY_OP(NUMBER_VAL, /);
-      break;
-    case OP_MODULO:
+      DISPATCH();
+    CASE_CODE(OP_MODULO):
       MODULO_OP(NUMBER_VAL, %);
-      break;
-    case OP_POWER:
+      DISPATCH();
+    CASE_CODE(OP_POWER):
       POW_OP(NUMBER_VAL, **);
-      break;
-    case OP_INCREMENT: {
-      double a = AS_NUMBER(pop());
-      push(NUMBER_VAL(a + 1));
-      break;
-    }
-    case OP_DECREMENT: {
-      double a = AS_NUMBER(pop());
-      push(NUMBER_VAL(a - 1));
-      break;
-    }
-
-    case OP_NOT:
-      push(BOOL_VAL(is_falsey(pop())));
-      break;
-    case OP_NEGATE: {
-      if (!IS_NUMBER(peek(0))) {
-        runtimeError("Operands must be numbers\n");
-        return INTERPRET_RUNTIME_ERROR;
+      DISPATCH();
+    CASE_CODE(OP_INCREMENT): {
+      double a = AS_NUMBER(POP());
+      PUSH(NUMBER_VAL(a + 1));
+      DISPATCH();
+    }
+    CASE_CODE(OP_DECREMENT): {
+      double a = AS_NUMBER(POP());
+      PUSH(NUMBER_VAL(a - 1));
+      DISPATCH();
+    }
+
+    CASE_CODE(OP_NOT):
+      PEEK(0) = BOOL_VAL(is_falsey(PEEK(0)));
+      DISPATCH();
+    CASE_CODE(OP_NEGATE): {
+      if (!IS_NUMBER(PEEK(0))) {
+        RUNTIME_ERROR("Operands must be numbers\n");
       }
-      push(NUMBER_VAL(-AS_NUMBER(pop())));
-      break;
+      PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+      DISPATCH();
     }
-    case OP_INVOKE: {
-      ObjString *method = AS_STRING(read_constant());
+    CASE_CODE(OP_INVOKE_LONG):
+      operand = read_long();
+      goto op_invoke;
+    CASE_CODE(OP_INVOKE):
+      operand = read_byte();
+    op_invoke: {
+      ObjString *method = AS_STRING(operand_constant());
       int arg_count = read_byte();
-      if (!invoke(method, arg_count)) {
+      InlineCache *cache = read_cache();
+      STORE_FRAME();
+      if (!invoke(method, arg_count, cache)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      frame = &vm.frames[vm.frame_count - 1];
-      break;
+      LOAD_FRAME();
+      DISPATCH();
     }
     // Closure operation codes
-    case OP_CLOSURE: {
-      ObjFunction *function = AS_FUNCTION(read_constant());
+    CASE_CODE(OP_CLOSURE_LONG):
+      operand = read_long();
+      goto op_closure;
+    CASE_CODE(OP_CLOSURE):
+      operand = read_byte();
+    op_closure: {
+      ObjFunction *function = AS_FUNCTION(operand_constant());
+      STORE_FRAME();
       ObjClosure *closure = new_closure(function);
-      push(OBJ_VAL(closure));
+      PUSH(OBJ_VAL(closure));
+      vm.stack_top = sp;
       for (int i = 0; i < closure->upvalue_count; i++) {
         uint8_t is_local = read_byte();
         uint8_t index = read_byte();
         if (is_local)
-          closure->upvalues[i] = capture_upvalue(frame->slots + index);
+          closure->upvalues[i] = capture_upvalue(slots + index);
         else
           closure->upvalues[i] = frame->closure->upvalues[index];
+        write_barrier((Obj *)closure, OBJ_VAL(closure->upvalues[i]));
       }
-      break;
+      DISPATCH();
     }
-    case OP_CLOSE_UPVALUE:
-      close_upvalues(vm.stack_top - 1);
-      pop();
-      break;
+    CASE_CODE(OP_CLOSE_UPVALUE):
+      close_upvalues(sp - 1);
+      sp--;
+      DISPATCH();
     // Jump operation codes for loops and if statements
-    case OP_JUMP: {
+    CASE_CODE(OP_JUMP): {
       uint16_t offset = read_short();
-      frame->ip += offset;
-      break;
+      ip += offset;
+      DISPATCH();
     }
-    case OP_JUMP_IF_FALSE: {
+    CASE_CODE(OP_JUMP_IF_FALSE): {
       uint16_t offset = read_short();
-      if (is_falsey(peek(0)))
-        frame->ip += offset;
-      break;
+      if (is_falsey(PEEK(0)))
+        ip += offset;
+      DISPATCH();
     }
-    case OP_LOOP: {
+    CASE_CODE(OP_LOOP): {
       uint16_t offset = read_short();
-      frame->ip -= offset;
-      break;
+      ip -= offset;
+      DISPATCH();
     }
-    case OP_BREAK: {
+    CASE_CODE(OP_BREAK): {
       uint16_t offset = read_short();
-      frame->ip += offset;
-      break;
+      ip += offset;
+      DISPATCH();
     }
     // Call operation codes
-    case OP_CALL: {
+    CASE_CODE(OP_CALL): {
       int arg_count = read_byte();
-      if (!call_value(peek(arg_count), arg_count))
+      STORE_FRAME();
+      if (!call_value(PEEK(arg_count), arg_count))
         return INTERPRET_RUNTIME_ERROR;
-      frame = &vm.frames[vm.frame_count - 1];
-      break;
+      LOAD_FRAME();
+      DISPATCH();
     }
     // Class operation codes
-    case OP_CLASS: {
-      push(OBJ_VAL(new_class(AS_STRING(read_constant()))));
-      break;
+    CASE_CODE(OP_CLASS_LONG):
+      operand = read_long();
+      goto op_class;
+    CASE_CODE(OP_CLASS):
+      operand = read_byte();
+    op_class: {
+      STORE_FRAME();
+      PUSH(OBJ_VAL(new_class(AS_STRING(operand_constant()))));
+      DISPATCH();
     }
-    case OP_INHERIT: {
-      Value superclass = peek(1);
-      ObjClass *subclass = AS_CLASS(peek(0));
+    CASE_CODE(OP_INHERIT): {
+      Value superclass = PEEK(1);
+      ObjClass *subclass = AS_CLASS(PEEK(0));
 
       if (!IS_CLASS(superclass)) {
-        runtimeError("Superclass must be a class");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Superclass must be a class");
       }
 
+      STORE_FRAME();
       table_add_all(&AS_CLASS(superclass)->methods, &subclass->methods);
-      pop();
-      break;
+      remember_object((Obj *)subclass);
+      vm.method_epoch++;
+      sp--;
+      DISPATCH();
     }
     // Statement operation codes
-    case OP_METHOD: {
-      define_method(AS_STRING(read_constant()));
-      break;
+    CASE_CODE(OP_METHOD_LONG):
+      operand = read_long();
+      goto op_method;
+    CASE_CODE(OP_METHOD):
+      operand = read_byte();
+    op_method: {
+      ObjString *name = AS_STRING(operand_constant());
+      STORE_FRAME();
+      define_method(name);
+      sp = vm.stack_top;
+      DISPATCH();
     }
-    case OP_IMPORT: {
-      ObjString *module_name = AS_STRING(pop());
-      ObjModule *module = load_module(module_name);
+    CASE_CODE(OP_IMPORT): {
+      ObjString *module_name = AS_STRING(POP());
+      STORE_FRAME();
+      load_module(module_name);
       loadedModules.insert(module_name);
-      table_add_all(&module->variables, &vm.globals);
-      break;
+      LOAD_FRAME();
+      DISPATCH();
     }
-    case OP_INFO: {
-      print_value(pop());
-      break;
+    CASE_CODE(OP_INFO): {
+      // Printing a rope flattens it.
+      STORE_FRAME();
+      print_value(PEEK(0));
+      sp--;
+      DISPATCH();
     }
-    case OP_INPUT: {
-      print_value(pop());
+    CASE_CODE(OP_INPUT): {
+      STORE_FRAME();
+      print_value(PEEK(0));
+      sp--;
       cout << " ";
       string value;
       getline(cin, value);
-      push(OBJ_VAL(copy_string(value.c_str(), (int)value.length())));
-      break;
-    }
-    case OP_DUP:
-      push(peek(0));
-      break;
-    case OP_RETURN: {
-      Value result = pop();
-      close_upvalues(frame->slots);
+      STORE_FRAME();
+      PUSH(OBJ_VAL(copy_string(value.c_str(), (int)value.length())));
+      DISPATCH();
+    }
+    CASE_CODE(OP_DUP): {
+      Value top = PEEK(0);
+      PUSH(top);
+      DISPATCH();
+    }
+    CASE_CODE(OP_RETURN): {
+      Value result = POP();
+      close_upvalues(slots);
       vm.frame_count--;
-      if (vm.frame_count == 0) {
-        pop();
+      if (vm.frame_count == base_frame_count) {
+        sp = slots;
+        vm.stack_top = sp;
         return INTERPRET_OK;
       }
-      vm.stack_top = frame->slots;
-      push(result);
+      sp = slots;
+      PUSH(result);
       frame = &vm.frames[vm.frame_count - 1];
-      break;
+      ip = frame->ip;
+      slots = frame->slots;
+      DISPATCH();
     }
-    default: {
+    CASE_DEFAULT: {
       return INTERPRET_RUNTIME_ERROR;
     }
-    }
   }
+
+  return INTERPRET_RUNTIME_ERROR;
+#undef INTERPRET_LOOP
+#undef CASE_CODE
+#undef CASE_DEFAULT
+#undef DISPATCH
+#undef TRACE_INSTRUCTION
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef RUNTIME_ERROR
 #undef BINARY_OP
 #undef MODULO_OP
 }
 
-InterpretResult interpret(const char *source) {
-  ObjFunction *function = compile(source);
-  if (function == nullptr) {
-    delete function;
-
+static InterpretResult run_script(ObjFunction *function) {
+  if (function == nullptr)
     return INTERPRET_COMPILE_ERROR;
-  }
 
   push(OBJ_VAL(function));
   ObjClosure *closure = new_closure(function);
@@ -935,3 +1332,16 @@ InterpretResult interpret(const char *source) {
 
   return run();
 }
+
+InterpretResult interpret(const char *source) {
+  return run_script(compile(source));
+}
+
+InterpretResult interpret_file(const char *path, const char *source) {
+#ifdef BYTECODE_CACHE
+  return run_script(compile_file(path, source));
+#else
+  (void)path;
+  return run_script(compile(source));
+#endif
+}
@@ -15,30 +15,60 @@ struct CallFrame {
   Value *slots;
 };
 
+// A global variable. The compiler resolves every global name to the index
+// of its slot, so the VM never hashes a name to read or write one.
+struct GlobalSlot {
+  Value value;
+  bool defined;
+  bool is_static;
+};
+
 struct VM {
   CallFrame frames[FRAMES_MAX];
   int frame_count;
 
   Value stack[STACK_MAX];
   Value *stack_top;
-  Table globals;
+  Table globals; // Global name -> NUMBER_VAL(slot in global_slots).
+  GlobalSlot *global_slots;
+  int global_count;
+  int global_capacity;
   Table strings;
-  Table statics;
   ObjString *init_string;
+  ObjString *char_strings[UINT8_COUNT]; // Interned one character strings.
   ObjUpvalue *open_upvalues;
 
   size_t bytes_allocated;
   size_t next_gc;
+  size_t nursery_bytes; // Allocated since the last collection.
 
   Table modules;
-  Obj *objects;
+  Obj *objects;     // Young generation.
+  Obj *old_objects; // Objects that survived a collection.
+  Obj *unswept;     // Old objects still to be swept after a major GC.
 
   int gray_count;
   int gray_capacity;
   Obj **gray_stack;
 
+  // Old objects that may point at young ones, rescanned by minor GCs.
+  int remembered_count;
+  int remembered_capacity;
+  Obj **remembered;
+  bool gc_minor;
+
+  // Set while an incremental major collection is marking the heap.
+  bool gc_marking;
+  // Objects blackened per incremental step, 0 collects in one pause.
+  int gc_step_budget;
+
   Table arrays;
   ValueArray array_values;
+
+  // Bumped whenever a method table changes, invalidating cached methods.
+  uint32_t method_epoch;
+  // Root of the shape tree, the shape of an instance with no fields.
+  ObjShape *empty_shape;
 };
 
 enum InterpretResult {
@@ -53,5 +83,10 @@ void init_vm();
 void free_vm();
 
 InterpretResult interpret(const char *source);
+InterpretResult interpret_file(const char *path, const char *source);
+int global_slot(ObjString *name);
+ObjString *global_name(int slot);
+void define_global(ObjString *name, Value value);
 void push(Value value);
 Value pop();
+bool is_falsey(Value value);